@@ -12,16 +12,92 @@ your program cannot change its value. We use such constants to avoid having
 #define texNEAREST 1
 #define texREPEAT 2
 #define texCLIP 3
+#define texTRILINEAR 4
+
+/* The formats in which a texture can store its channels. texUNORM8 stores each 
+channel in a byte, as a value from 0 to 1 in steps of 1 / 255, which is exactly 
+what 8-bit image files hold; with texelDim 4 or 1 it is the familiar RGBA8 or 
+R8. texHALF stores IEEE half-precision floats (float16), texFLOAT single, and 
+texDOUBLE double precision. Whatever the format, texels are read and written 
+as doubles. Sampling filters the stored values, and scales the result to a 
+double only at the end. */
+#define texUNORM8 0
+#define texHALF 1
+#define texFLOAT 2
+#define texDOUBLE 3
+
+/* The layouts in which a texture can arrange its texels. texROWS stores them 
+row by row, from the bottom row up. texTILES stores them in square tiles of 
+texTILESIZE x texTILESIZE texels, tile by tile, from the bottom row of tiles 
+up, and row by row within each tile. Then the 2 x 2 texels of a bilinear 
+sample are usually within 16 texels of each other, and texels above and below 
+each other are close, instead of a whole row apart. The tiles at the top and 
+right edges are padded if needed. */
+#define texROWS 0
+#define texTILES 1
+#define texTILESIZE 4
+
+/* A texture has at most this many mipmap levels, enough for 32768 texels on 
+a side. */
+#define texLEVELMAX 16
+
+/* One level of a texture's mipmap chain. Level 0 is the texture itself, and 
+each further level is half the width and height of the last (rounded down, but 
+at least 1), each texel averaging a 2 x 2 box of texels of the level below. */
+typedef struct texLevel texLevel;
+struct texLevel {
+    int width, height;
+    void *data;         /* width * height * texelDim channels, in the texture's layout */
+};
 
 typedef struct texTexture texTexture;
-/* Feel free to read from this struct's members, but don't write to them. */
+
+/* A function that samples mipmap level number level of the texture, as 
+texSample would sample level 0. Each texture has one, chosen for its 
+filtering, format, and texel dimension by texSetFiltering and texConvert. */
+typedef void (*texSampler)(
+    const texTexture *tex, int level, double s, double t, double sample[]);
+
+/* Feel free to read from this struct's members, but don't write to them. The 
+exception is lod, which renderers may set in their own copies of the struct, 
+to tell texSample which mipmap levels to use. */
 struct texTexture {
     int width, height;  /* do not have to be powers of 2 */
     int texelDim;       /* e.g. 3 for RGB textures */
-    int filtering;      /* texLINEAR or texNEAREST */
+    int filtering;      /* texLINEAR, texNEAREST, or texTRILINEAR */
     int topBottom;      /* texREPEAT or texCLIP */
     int leftRight;      /* texREPEAT or texCLIP */
-    double *data;       /* width * height * texelDim doubles, row-major order */
+    int format;         /* texUNORM8, texHALF, texFLOAT, or texDOUBLE */
+    int layout;         /* texROWS or texTILES */
+    void *data;         /* width * height * texelDim channels, in the layout */
+    int levelNum;       /* the number of mipmap levels, counting level 0 */
+    texLevel *levels;   /* levelNum levels, where levels[0].data is data */
+    double lod;         /* the level of detail used by texSample with texTRILINEAR */
+    texSampler sampler; /* bilinear for texTRILINEAR, since it samples 2 levels */
+    char *file;         /* the mapped file, if from texInitializeCooked, or NULL */
+    long fileSize;      /* the size of that file in bytes */
+};
+
+/* A cooked texture file, as written by texWriteCooked, is this header, 
+followed by the texture's mipmap levels, each starting at a multiple of 
+texCOOKEDALIGN bytes from the start of the file. Each level is just its texels, 
+in the texture's format and layout, exactly as they are in memory, so that the 
+file can be mapped into memory and sampled where it is. The numbers are in 
+the byte order of the machine that wrote the file. */
+#define texCOOKEDMAGIC "texCook"
+#define texCOOKEDVERSION 1
+#define texCOOKEDALIGN 64
+/* The largest width, height, and texelDim that a cooked texture may have, so 
+that the sizes of its levels are never near overflowing. */
+#define texCOOKEDSIDEMAX (1 << (texLEVELMAX - 1))
+#define texCOOKEDDIMMAX 256
+typedef struct texCookedHeader texCookedHeader;
+struct texCookedHeader {
+    char magic[8];      /* texCOOKEDMAGIC, with its terminating 0 */
+    int version;        /* texCOOKEDVERSION */
+    int width, height, texelDim, format, layout, levelNum;
+    int padding;        /* 0 */
+    long long offsets[texLEVELMAX];     /* levelNum byte offsets of the levels */
 };
 
 
@@ -31,52 +107,434 @@ struct texTexture {
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STBI_FAILURE_USERMSG
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Returns the number of bytes in each channel of the format. */
+int texGetSize(int format) {
+    if (format == texUNORM8)
+        return 1;
+    else if (format == texHALF)
+        return 2;
+    else if (format == texFLOAT)
+        return 4;
+    else
+        return 8;
+}
+
+/* Converts a half-precision float, given by its bits, to a double. */
+double texHalfToDouble(unsigned short half) {
+    int exponent = (half >> 10) & 31, mantissa = half & 1023;
+    double value;
+    if (exponent == 0)
+        value = ldexp(mantissa, -24);
+    else if (exponent == 31)
+        value = (mantissa == 0 ? HUGE_VAL : NAN);
+    else
+        value = ldexp(mantissa + 1024, exponent - 25);
+    return ((half & 0x8000) ? -value : value);
+}
+
+/* Converts a double to the bits of the nearest half-precision float, rounding 
+ties to even. Values too large for half precision become infinite. */
+unsigned short texDoubleToHalf(double value) {
+    unsigned short sign = (signbit(value) ? 0x8000 : 0);
+    double magnitude = fabs(value), fraction;
+    int exponent;
+    if (isnan(value))
+        return 0x7E00;
+    if (magnitude >= 65520.0)
+        return sign | 0x7C00;
+    /* Subnormals are multiples of 2^-24. Rounding up to 1024 of them gives the 
+    smallest normal, whose bits are the same. */
+    if (magnitude < ldexp(1.0, -14))
+        return sign | (unsigned short)nearbyint(magnitude * 16777216.0);
+    /* Here magnitude = fraction * 2^exponent with fraction in [0.5, 1). If the 
+    mantissa rounds up to 1024, it carries into the exponent, as it should. */
+    fraction = frexp(magnitude, &exponent);
+    return sign | (((exponent + 14) << 10) + 
+        (unsigned short)nearbyint((fraction * 2.0 - 1.0) * 1024.0));
+}
+
+/* Returns the number by which stored values of the format must be divided to 
+get the values that they represent. */
+double texGetScale(int format) {
+    return (format == texUNORM8 ? 255.0 : 1.0);
+}
+
+/* Returns channel number index of data in the given format, as stored, before 
+it is divided by texGetScale(format). */
+double texGetStored(int format, const void *data, long index) {
+    if (format == texUNORM8)
+        return ((const unsigned char *)data)[index];
+    else if (format == texHALF)
+        return texHalfToDouble(((const unsigned short *)data)[index]);
+    else if (format == texFLOAT)
+        return ((const float *)data)[index];
+    else
+        return ((const double *)data)[index];
+}
+
+/* Returns channel number index of data in the given format, as a double. */
+double texDecode(int format, const void *data, long index) {
+    return texGetStored(format, data, index) / texGetScale(format);
+}
+
+/* Stores value as channel number index of data in the given format. texUNORM8 
+clamps it to [0, 1] and rounds it to the nearest step. */
+void texEncode(int format, void *data, long index, double value) {
+    if (format == texUNORM8) {
+        value = (value > 0.0 ? value : 0.0);
+        value = (value < 1.0 ? value : 1.0);
+        ((unsigned char *)data)[index] = (unsigned char)(value * 255.0 + 0.5);
+    } else if (format == texHALF)
+        ((unsigned short *)data)[index] = texDoubleToHalf(value);
+    else if (format == texFLOAT)
+        ((float *)data)[index] = value;
+    else
+        ((double *)data)[index] = value;
+}
+
+
+/* Returns the number of texels that a width x height level occupies in the 
+layout, counting padding. */
+long texGetTexelNum(int layout, int width, int height) {
+    if (layout == texTILES) {
+        long across = (width + texTILESIZE - 1) / texTILESIZE;
+        long down = (height + texTILESIZE - 1) / texTILESIZE;
+        return across * down * texTILESIZE * texTILESIZE;
+    }
+    return (long)width * height;
+}
+
+/* Returns the position of texel (x, y) among the texels of a level of the 
+given width in the layout. Multiply it by texelDim to get the index of its 
+first channel. */
+long texGetTexelIndex(int layout, int width, int x, int y) {
+    if (layout == texTILES) {
+        long across = (width + texTILESIZE - 1) / texTILESIZE;
+        long tile = across * (y / texTILESIZE) + x / texTILESIZE;
+        return tile * texTILESIZE * texTILESIZE + 
+            texTILESIZE * (y % texTILESIZE) + x % texTILESIZE;
+    }
+    return x + (long)width * y;
+}
+
+/* Returns whether data points into the texture's mapped file, in which case it 
+must not be freed. */
+int texIsInFile(const texTexture *tex, const void *data) {
+    return tex->file != NULL && (const char *)data >= tex->file && 
+        (const char *)data < tex->file + tex->fileSize;
+}
+
+/* Returns the texture coordinate s wrapped into [0, 1], by texREPEAT or else by 
+clipping. */
+double texWrap(int wrapping, double s) {
+    if (wrapping == texREPEAT)
+        return s - floor(s);
+    else if (s < 0.0)
+        return 0.0;
+    else if (s > 1.0)
+        return 1.0;
+    return s;
+}
+
+/* Finds the channel indices of the 2 x 2 texels of a bilinear sample, in a 
+level of the given width. They are the bottom left, bottom right, top left, and 
+top right texels, in that order. */
+void texGetFootprint(
+        int layout, int width, int texelDim, int left, int right, int bottom, 
+        int top, long texels[4]) {
+    texels[0] = texGetTexelIndex(layout, width, left, bottom);
+    if (layout == texTILES && left % texTILESIZE != texTILESIZE - 1 && 
+            bottom % texTILESIZE != texTILESIZE - 1) {
+        /* The 2 x 2 texels are in one tile, so they are found from the first 
+        without any more tile arithmetic. */
+        texels[1] = texels[0] + (right - left);
+        texels[2] = texels[0] + texTILESIZE * (top - bottom);
+        texels[3] = texels[2] + (right - left);
+    } else {
+        texels[1] = texGetTexelIndex(layout, width, right, bottom);
+        texels[2] = texGetTexelIndex(layout, width, left, top);
+        texels[3] = texGetTexelIndex(layout, width, right, top);
+    }
+    texels[0] *= texelDim;
+    texels[1] *= texelDim;
+    texels[2] *= texelDim;
+    texels[3] *= texelDim;
+}
+
+/* Samples mipmap level number level, with nearest-neighbor (texNEAREST) or 
+bilinear (otherwise) filtering, after wrapping. It works for every format and 
+texel dimension. */
+void texSampleLevel(
+        const texTexture *tex, int level, int filtering, double s, double t, 
+        double sample[]) {
+    const texLevel *lev = &tex->levels[level];
+    /* Handle clipping vs. repeating, and scale to image space. */
+    double u, v;
+    u = texWrap(tex->leftRight, s) * (lev->width - 1);
+    v = texWrap(tex->topBottom, t) * (lev->height - 1);
+    int k, texelDim = tex->texelDim, format = tex->format;
+
+    /* Handle nearest-neighbor vs. linear filtering. */
+    if (filtering == texNEAREST) {
+        long texel = texGetTexelIndex(
+            tex->layout, lev->width, (int)round(u), (int)round(v)) * texelDim;
+        for (k = 0; k < texelDim; k += 1)
+            sample[k] = texDecode(format, lev->data, texel + k);
+    } else {
+        double scale = texGetScale(format);
+        double fracU = u - floor(u);
+        double fracV = v - floor(v);
+
+        // Get the texels which will be combined to produce the final color
+        long texels[4];
+        texGetFootprint(tex->layout, lev->width, texelDim, (int)floor(u), 
+            (int)ceil(u), (int)floor(v), (int)ceil(v), texels);
+
+        // Combine their stored values, weighted, and then scale the result
+        for (k = 0; k < texelDim; k += 1)
+            sample[k] = ((1 - fracU) * fracV * texGetStored(format, lev->data, texels[2] + k) + 
+                fracU * fracV * texGetStored(format, lev->data, texels[3] + k) + 
+                ((1 - fracU) * (1- fracV) * texGetStored(format, lev->data, texels[0] + k) + 
+                fracU * (1- fracV) * texGetStored(format, lev->data, texels[1] + k))) / scale;
+    }
+}
+
+/* The body of the texUNORM8 samplers below, after wrapping, at (u, v) in the 
+image space of level lev. Called with constant linear and texelDim, it is 
+inlined without the branches on them, and with its loops over the channels 
+unrolled. It reads bytes directly instead of through texGetStored, and it 
+floors by truncation, since wrapped coordinates are never negative. It returns 
+exactly what texSampleLevel does. */
+static inline void texSampleBytesAt(
+        const texTexture *tex, const texLevel *lev, int linear, int texelDim, 
+        double u, double v, double sample[]) {
+    const unsigned char *data = (const unsigned char *)lev->data;
+    int k;
+    if (!linear) {
+        const unsigned char *texel = &data[texGetTexelIndex(
+            tex->layout, lev->width, (int)round(u), (int)round(v)) * texelDim];
+        for (k = 0; k < texelDim; k += 1)
+            sample[k] = texel[k] / 255.0;
+        return;
+    }
+    int left = (int)u, bottom = (int)v;
+    double fracU = u - left, fracV = v - bottom;
+    long texels[4];
+    texGetFootprint(tex->layout, lev->width, texelDim, left, left + (fracU > 0.0), 
+        bottom, bottom + (fracV > 0.0), texels);
+    const unsigned char *bl = &data[texels[0]], *br = &data[texels[1]];
+    const unsigned char *tl = &data[texels[2]], *tr = &data[texels[3]];
+    for (k = 0; k < texelDim; k += 1)
+        sample[k] = ((1 - fracU) * fracV * tl[k] + fracU * fracV * tr[k] + 
+            ((1 - fracU) * (1- fracV) * bl[k] + fracU * (1- fracV) * br[k])) / 255.0;
+}
+
+static inline void texSampleBytes(
+        const texTexture *tex, int level, int linear, int texelDim, double s, 
+        double t, double sample[]) {
+    const texLevel *lev = &tex->levels[level];
+    texSampleBytesAt(tex, lev, linear, texelDim, 
+        texWrap(tex->leftRight, s) * (lev->width - 1), 
+        texWrap(tex->topBottom, t) * (lev->height - 1), sample);
+}
+
+/* The samplers that texChooseSampler chooses from. */
+
+void texSampleNearest(
+        const texTexture *tex, int level, double s, double t, double sample[]) {
+    texSampleLevel(tex, level, texNEAREST, s, t, sample);
+}
+
+void texSampleLinear(
+        const texTexture *tex, int level, double s, double t, double sample[]) {
+    texSampleLevel(tex, level, texLINEAR, s, t, sample);
+}
+
+void texSampleNearestBytes(
+        const texTexture *tex, int level, double s, double t, double sample[]) {
+    texSampleBytes(tex, level, 0, tex->texelDim, s, t, sample);
+}
+
+void texSampleLinearBytes(
+        const texTexture *tex, int level, double s, double t, double sample[]) {
+    texSampleBytes(tex, level, 1, tex->texelDim, s, t, sample);
+}
+
+void texSampleNearestBytes3(
+        const texTexture *tex, int level, double s, double t, double sample[]) {
+    texSampleBytes(tex, level, 0, 3, s, t, sample);
+}
+
+void texSampleLinearBytes3(
+        const texTexture *tex, int level, double s, double t, double sample[]) {
+    texSampleBytes(tex, level, 1, 3, s, t, sample);
+}
+
+void texSampleNearestBytes4(
+        const texTexture *tex, int level, double s, double t, double sample[]) {
+    texSampleBytes(tex, level, 0, 4, s, t, sample);
+}
+
+void texSampleLinearBytes4(
+        const texTexture *tex, int level, double s, double t, double sample[]) {
+    texSampleBytes(tex, level, 1, 4, s, t, sample);
+}
+
+/* Chooses the texture's sampler, for its current filtering, format, and texel 
+dimension. Must be called whenever any of those changes. */
+void texChooseSampler(texTexture *tex) {
+    int linear = (tex->filtering != texNEAREST);
+    if (tex->format != texUNORM8)
+        tex->sampler = (linear ? texSampleLinear : texSampleNearest);
+    else if (tex->texelDim == 3)
+        tex->sampler = (linear ? texSampleLinearBytes3 : texSampleNearestBytes3);
+    else if (tex->texelDim == 4)
+        tex->sampler = (linear ? texSampleLinearBytes4 : texSampleNearestBytes4);
+    else
+        tex->sampler = (linear ? texSampleLinearBytes : texSampleNearestBytes);
+}
 
 
 
 /*** Public: Basics ***/
 
+/* Builds the texture's mipmap levels from its texels, replacing any old ones. 
+It is called by the initializers, but it must be called again after texels are 
+changed by texSetTexel or texClearTexels, before sampling with texTRILINEAR. 
+Returns 0 if no error occurred. */
+int texBuildMipmaps(texTexture *tex) {
+    int levelNum, width, height, level, i, j, k, iHigh, jHigh;
+    long size;
+    /* Count the levels, and the channels that they need beyond level 0. */
+    levelNum = 1;
+    width = tex->width;
+    height = tex->height;
+    size = 0;
+    while ((width > 1 || height > 1) && levelNum < texLEVELMAX) {
+        width = (width > 1 ? width / 2 : 1);
+        height = (height > 1 ? height / 2 : 1);
+        size += texGetTexelNum(tex->layout, width, height) * tex->texelDim;
+        levelNum += 1;
+    }
+    texLevel *levels = (texLevel *)malloc(levelNum * sizeof(texLevel));
+    char *data = (size > 0 ? (char *)malloc(size * texGetSize(tex->format)) : NULL);
+    if (levels == NULL || (size > 0 && data == NULL)) {
+        fprintf(stderr, "error: texBuildMipmaps: malloc failed\n");
+        free(levels);
+        free(data);
+        return 1;
+    }
+    if (tex->levels != NULL) {
+        if (tex->levelNum > 1 && !texIsInFile(tex, tex->levels[1].data))
+            free(tex->levels[1].data);
+        free(tex->levels);
+    }
+    levels[0].width = tex->width;
+    levels[0].height = tex->height;
+    levels[0].data = tex->data;
+    for (level = 1; level < levelNum; level += 1) {
+        const texLevel *below = &levels[level - 1];
+        texLevel *above = &levels[level];
+        above->width = (below->width > 1 ? below->width / 2 : 1);
+        above->height = (below->height > 1 ? below->height / 2 : 1);
+        above->data = data;
+        data += texGetTexelNum(tex->layout, above->width, above->height) * 
+            tex->texelDim * texGetSize(tex->format);
+        /* Box filter. An odd texel left over at an edge joins the last box. */
+        for (i = 0; i < above->width; i += 1)
+            for (j = 0; j < above->height; j += 1) {
+                iHigh = (2 * i + 1 < below->width ? 2 * i + 1 : below->width - 1);
+                jHigh = (2 * j + 1 < below->height ? 2 * j + 1 : below->height - 1);
+                if (i == above->width - 1)
+                    iHigh = below->width - 1;
+                if (j == above->height - 1)
+                    jHigh = below->height - 1;
+                for (k = 0; k < tex->texelDim; k += 1) {
+                    double sum = 0.0;
+                    int s, t;
+                    for (s = 2 * i; s <= iHigh; s += 1)
+                        for (t = 2 * j; t <= jHigh; t += 1)
+                            sum += texDecode(tex->format, below->data, 
+                                texGetTexelIndex(tex->layout, below->width, s, t) * 
+                                tex->texelDim + k);
+                    texEncode(tex->format, above->data, 
+                        texGetTexelIndex(tex->layout, above->width, i, j) * 
+                        tex->texelDim + k, 
+                        sum / ((iHigh - 2 * i + 1) * (jHigh - 2 * j + 1)));
+                }
+            }
+    }
+    tex->levelNum = levelNum;
+    tex->levels = levels;
+    return 0;
+}
+
 /* Sets all texels within the texture. Assumes that the texture has already 
 been initialized. Assumes that texel has the same texel dimension as the 
 texture. */
 void texClearTexels(texTexture *tex, const double texel[]) {
-    int index, bound, k;
-    bound = tex->texelDim * tex->width * tex->height;
+    long index, bound;
+    int k;
+    bound = tex->texelDim * texGetTexelNum(tex->layout, tex->width, tex->height);
     for (index = 0; index < bound; index += tex->texelDim)
         for (k = 0; k < tex->texelDim; k += 1)
-            tex->data[index + k] = texel[k];
+            texEncode(tex->format, tex->data, index + k, texel[k]);
 }
 
 /* Initializes a texTexture struct to a given width and height and a solid 
-color. The width and height do not have to be powers of 2. Returns 0 if no 
-error occurred. The user must remember to call texFinalize when finished with 
-the texture. */
+color. The width and height do not have to be powers of 2. The texels are 
+stored as texDOUBLE, so that they can hold any values; call texConvert to store 
+them more compactly. Returns 0 if no error occurred. The user must remember to 
+call texFinalize when finished with the texture. */
 int texInitializeSolid(
         texTexture *tex, int width, int height, int texelDim, 
         const double texel[]) {
+    tex->file = NULL;
+    tex->fileSize = 0;
     tex->width = width;
     tex->height = height;
     tex->texelDim = texelDim;
-    tex->data = (double *)malloc(width * height * texelDim * sizeof(double));
+    tex->format = texDOUBLE;
+    tex->layout = texROWS;
+    tex->filtering = texLINEAR;
+    tex->topBottom = texCLIP;
+    tex->leftRight = texCLIP;
+    texChooseSampler(tex);
+    tex->levelNum = 0;
+    tex->levels = NULL;
+    tex->lod = 0.0;
+    tex->data = malloc((long)width * height * texelDim * sizeof(double));
     if (tex->data == NULL) {
         fprintf(stderr, "error: texInitializeSolid: malloc failed\n");
         return 1;
     }
     texClearTexels(tex, texel);
+    if (texBuildMipmaps(tex) != 0) {
+        free(tex->data);
+        return 3;
+    }
     return 0;
 }
 
 /* Initializes a texTexture struct by loading an image from a file. Many image 
 types are supported (using the public-domain STB Image library). The width and 
-height do not have to be powers of 2. Returns 0 if no error occurred. The user 
-must remember to call texFinalize when finished with the texture. */
+height do not have to be powers of 2. The texels are stored as texUNORM8, just 
+as the file holds them. Returns 0 if no error occurred. The user must remember 
+to call texFinalize when finished with the texture. */
 /* WARNING: Currently there is a weird behavior, in which some image files show 
 up with their rows and columns switched, so that their width and height are 
 flipped. If that's happening with your image, then use a different image. */
 int texInitializeFile(texTexture *tex, const char *path) {
     /* Use the STB image library to load the file as unsigned chars. */
     unsigned char *rawData;
-    int x, y, z, newInd, oldInd;
+    int y, rowSize;
+    tex->file = NULL;
+    tex->fileSize = 0;
     rawData = stbi_load(path, &(tex->width), &(tex->height), &(tex->texelDim), 
         0);
     if (rawData == NULL) {
@@ -85,21 +543,31 @@ int texInitializeFile(texTexture *tex, const char *path) {
         fprintf(stderr, "    with STB Image reason: %s\n", stbi_failure_reason());
         return 2;
     }
-    tex->data = (double *)malloc((tex->width * tex->height) * tex->texelDim * sizeof(double));
+    tex->format = texUNORM8;
+    tex->layout = texROWS;
+    tex->filtering = texLINEAR;
+    tex->topBottom = texCLIP;
+    tex->leftRight = texCLIP;
+    texChooseSampler(tex);
+    rowSize = tex->width * tex->texelDim;
+    tex->data = malloc((long)rowSize * tex->height);
     if (tex->data == NULL) {
         fprintf(stderr, "error: texInitializeFile: malloc failed\n");
         stbi_image_free(rawData);
         return 1;
     }
     /* STB Image starts in the upper-left, while I want the lower-left. */
-    for (x = 0; x < tex->width; x += 1)
-        for (y = 0; y < tex->height; y += 1) {
-            newInd = tex->texelDim * (x + tex->width * y);
-            oldInd = tex->texelDim * (x + tex->width * (tex->height - 1 - y));
-            for (z = 0; z < tex->texelDim; z += 1)
-                tex->data[newInd + z] = rawData[oldInd + z] / 255.0;
-        }
+    for (y = 0; y < tex->height; y += 1)
+        memcpy((unsigned char *)tex->data + (long)rowSize * y, 
+            rawData + (long)rowSize * (tex->height - 1 - y), rowSize);
     stbi_image_free(rawData);
+    tex->levelNum = 0;
+    tex->levels = NULL;
+    tex->lod = 0.0;
+    if (texBuildMipmaps(tex) != 0) {
+        free(tex->data);
+        return 3;
+    }
     return 0;
 }
 
@@ -113,9 +581,231 @@ handled in the code above.
     oldInd = tex->texelDim * (tex->height * (tex->width - x + 1) - y);
 */
 
-/* Sets the texture filtering, to either texNEAREST or texLINEAR. */
+/* Writes the texture, with all of its mipmap levels, to a cooked texture file, 
+which texInitializeCooked can load much faster than texInitializeFile can load 
+an image. Returns 0 if no error occurred. The texture must be at most 
+texCOOKEDSIDEMAX texels on a side, with at most texCOOKEDDIMMAX channels. */
+int texWriteCooked(const texTexture *tex, const char *path) {
+    texCookedHeader header;
+    long long offset;
+    long size;
+    int level;
+    static const char zeros[texCOOKEDALIGN] = {0};
+    if (tex->width > texCOOKEDSIDEMAX || tex->height > texCOOKEDSIDEMAX || 
+            tex->texelDim > texCOOKEDDIMMAX) {
+        fprintf(stderr, "error: texWriteCooked: texture is too big to cook\n");
+        return 1;
+    }
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, texCOOKEDMAGIC);
+    header.version = texCOOKEDVERSION;
+    header.width = tex->width;
+    header.height = tex->height;
+    header.texelDim = tex->texelDim;
+    header.format = tex->format;
+    header.layout = tex->layout;
+    header.levelNum = tex->levelNum;
+    offset = sizeof(header);
+    for (level = 0; level < tex->levelNum; level += 1) {
+        const texLevel *lev = &tex->levels[level];
+        offset = (offset + texCOOKEDALIGN - 1) / texCOOKEDALIGN * texCOOKEDALIGN;
+        header.offsets[level] = offset;
+        offset += texGetTexelNum(tex->layout, lev->width, lev->height) * 
+            tex->texelDim * texGetSize(tex->format);
+    }
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "error: texWriteCooked: could not open %s\n", path);
+        return 2;
+    }
+    offset = sizeof(header);
+    fwrite(&header, sizeof(header), 1, file);
+    for (level = 0; level < tex->levelNum; level += 1) {
+        const texLevel *lev = &tex->levels[level];
+        fwrite(zeros, 1, header.offsets[level] - offset, file);
+        size = texGetTexelNum(tex->layout, lev->width, lev->height) * 
+            tex->texelDim * texGetSize(tex->format);
+        fwrite(lev->data, 1, size, file);
+        offset = header.offsets[level] + size;
+    }
+    if (ferror(file) || fclose(file) != 0) {
+        fprintf(stderr, "error: texWriteCooked: could not write %s\n", path);
+        return 3;
+    }
+    return 0;
+}
+
+/* Initializes a texTexture struct from a cooked texture file, as written by 
+texWriteCooked. Nothing is decoded or copied: the file is mapped into memory, 
+and the texture samples its levels where they are. So loading takes no time, 
+however large the texture, and processes that load the same file share its 
+memory. Texels can still be changed with texSetTexel and the like; the changed 
+pages are copied, and the file is not changed. Returns 0 if no error occurred. 
+The user must remember to call texFinalize when finished with the texture. */
+int texInitializeCooked(texTexture *tex, const char *path) {
+    struct stat status;
+    const texCookedHeader *header;
+    int level, width, height;
+    tex->file = NULL;
+    tex->fileSize = 0;
+    tex->data = NULL;
+    tex->levels = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: texInitializeCooked: could not open %s\n", path);
+        return 1;
+    }
+    if (fstat(fd, &status) != 0 || status.st_size < (off_t)sizeof(texCookedHeader)) {
+        fprintf(stderr, "error: texInitializeCooked: %s is too short\n", path);
+        close(fd);
+        return 2;
+    }
+    /* A private mapping, so that writes to the texels do not reach the file. */
+    void *file = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, 
+        fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "error: texInitializeCooked: could not map %s\n", path);
+        return 3;
+    }
+    tex->file = (char *)file;
+    tex->fileSize = status.st_size;
+    header = (const texCookedHeader *)file;
+    if (memcmp(header->magic, texCOOKEDMAGIC, sizeof(texCOOKEDMAGIC)) != 0 || 
+            header->version != texCOOKEDVERSION || header->width <= 0 || 
+            header->width > texCOOKEDSIDEMAX || header->height <= 0 || 
+            header->height > texCOOKEDSIDEMAX || header->texelDim <= 0 || 
+            header->texelDim > texCOOKEDDIMMAX || 
+            header->format < texUNORM8 || header->format > texDOUBLE || 
+            header->layout < texROWS || header->layout > texTILES || 
+            header->levelNum < 1 || header->levelNum > texLEVELMAX) {
+        fprintf(stderr, "error: texInitializeCooked: %s is not a cooked texture\n", 
+            path);
+        munmap(file, status.st_size);
+        tex->file = NULL;
+        return 4;
+    }
+    tex->levels = (texLevel *)malloc(header->levelNum * sizeof(texLevel));
+    if (tex->levels == NULL) {
+        fprintf(stderr, "error: texInitializeCooked: malloc failed\n");
+        munmap(file, status.st_size);
+        tex->file = NULL;
+        return 5;
+    }
+    /* Check that every level is where it should be, and fits in the file. The 
+    size is at most 2^41 bytes, by the checks above, and the offset is compared 
+    without adding, so none of this can overflow. */
+    width = header->width;
+    height = header->height;
+    for (level = 0; level < header->levelNum; level += 1) {
+        long long offset = header->offsets[level];
+        long long size = texGetTexelNum(header->layout, width, height) * 
+            header->texelDim * texGetSize(header->format);
+        if (offset < (long long)sizeof(texCookedHeader) || 
+                offset % texCOOKEDALIGN != 0 || size > status.st_size || 
+                offset > status.st_size - size) {
+            fprintf(stderr, "error: texInitializeCooked: %s is truncated\n", path);
+            free(tex->levels);
+            tex->levels = NULL;
+            munmap(file, status.st_size);
+            tex->file = NULL;
+            return 6;
+        }
+        tex->levels[level].width = width;
+        tex->levels[level].height = height;
+        tex->levels[level].data = tex->file + offset;
+        width = (width > 1 ? width / 2 : 1);
+        height = (height > 1 ? height / 2 : 1);
+    }
+    tex->width = header->width;
+    tex->height = header->height;
+    tex->texelDim = header->texelDim;
+    tex->format = header->format;
+    tex->layout = header->layout;
+    tex->levelNum = header->levelNum;
+    tex->data = tex->levels[0].data;
+    tex->lod = 0.0;
+    tex->filtering = texLINEAR;
+    tex->topBottom = texCLIP;
+    tex->leftRight = texCLIP;
+    texChooseSampler(tex);
+    return 0;
+}
+
+/* Converts the texture's texels to the given format, such as texUNORM8 to save
+memory, and rebuilds its mipmaps. Converting to texUNORM8 clamps the channels
+to [0, 1], and texHALF rounds them to about 3 decimal digits. Returns 0 if no
+error occurred. On error, the texture is unchanged. */
+int texConvert(texTexture *tex, int format) {
+    long index, bound;
+    bound = texGetTexelNum(tex->layout, tex->width, tex->height) * tex->texelDim;
+    void *data = malloc(bound * texGetSize(format));
+    if (data == NULL) {
+        fprintf(stderr, "error: texConvert: malloc failed\n");
+        return 1;
+    }
+    for (index = 0; index < bound; index += 1)
+        texEncode(format, data, index, texDecode(tex->format, tex->data, index));
+    /* texBuildMipmaps leaves the old levels alone if it fails. */
+    void *oldData = tex->data;
+    int oldFormat = tex->format;
+    tex->data = data;
+    tex->format = format;
+    if (texBuildMipmaps(tex) != 0) {
+        tex->data = oldData;
+        tex->format = oldFormat;
+        free(data);
+        return 2;
+    }
+    if (!texIsInFile(tex, oldData))
+        free(oldData);
+    texChooseSampler(tex);
+    return 0;
+}
+
+/* Rearranges the texture's texels into the given layout, texROWS or texTILES, 
+and rebuilds its mipmaps. Textures start out in texROWS. Texels keep their 
+coordinates, so nothing but speed changes. Does nothing if the texture is 
+already in that layout. Returns 0 if no error occurred. On error, the texture 
+is unchanged. */
+int texSetLayout(texTexture *tex, int layout) {
+    int x, y, size = tex->texelDim * texGetSize(tex->format);
+    if (layout == tex->layout)
+        return 0;
+    char *data = (char *)malloc(
+        texGetTexelNum(layout, tex->width, tex->height) * size);
+    if (data == NULL) {
+        fprintf(stderr, "error: texSetLayout: malloc failed\n");
+        return 1;
+    }
+    for (y = 0; y < tex->height; y += 1)
+        for (x = 0; x < tex->width; x += 1) {
+            long from = texGetTexelIndex(tex->layout, tex->width, x, y);
+            long to = texGetTexelIndex(layout, tex->width, x, y);
+            memcpy(data + to * size, (char *)tex->data + from * size, size);
+        }
+    /* texBuildMipmaps leaves the old levels alone if it fails. */
+    void *oldData = tex->data;
+    int oldLayout = tex->layout;
+    tex->data = data;
+    tex->layout = layout;
+    if (texBuildMipmaps(tex) != 0) {
+        tex->data = oldData;
+        tex->layout = oldLayout;
+        free(data);
+        return 2;
+    }
+    if (!texIsInFile(tex, oldData))
+        free(oldData);
+    return 0;
+}
+
+/* Sets the texture filtering, to texNEAREST, texLINEAR, or texTRILINEAR. The 
+first two sample only level 0 in texSample. texTRILINEAR filters bilinearly 
+within the two mipmap levels nearest to the level of detail, and blends them. */
 void texSetFiltering(texTexture *tex, int filtering) {
     tex->filtering = filtering;
+    texChooseSampler(tex);
 }
 
 /* Sets the texture wrapping for the top and bottom edges, to either texCLIP 
@@ -136,87 +826,167 @@ texel (width - 1, 0) is in the lower right corner, etc. */
 void texGetTexel(const texTexture *tex, int s, int t, double texel[]) {
     int k;
     for (k = 0; k < tex->texelDim; k += 1)
-        texel[k] = tex->data[(s + tex->width * t) * tex->texelDim + k];
+        texel[k] = texDecode(tex->format, tex->data, 
+            texGetTexelIndex(tex->layout, tex->width, s, t) * tex->texelDim + k);
 }
 
-/* Sets a single texel within the texture. For details, see texGetTexel. */
+/* Sets a single texel within the texture. For details, see texGetTexel. The 
+mipmap levels are not updated until texBuildMipmaps is called. */
 void texSetTexel(texTexture *tex, int x, int y, const double texel[]) {
     if (0 <= x && x < tex->width && 0 <= y && y < tex->height
             && tex->data != NULL) {
-        int index, k;
-        index = tex->texelDim * (x + tex->width * y);
+        long index;
+        int k;
+        index = texGetTexelIndex(tex->layout, tex->width, x, y) * tex->texelDim;
         for (k = 0; k < tex->texelDim; k += 1)
-            tex->data[index + k] = texel[k];
+            texEncode(tex->format, tex->data, index + k, texel[k]);
     }
 }
 
 /* Deallocates the resources backing the texture. This function must be called 
 when the user is finished using the texture. */
 void texFinalize(texTexture *tex) {
-    free(tex->data);
+    if (tex->levels != NULL) {
+        if (tex->levelNum > 1 && !texIsInFile(tex, tex->levels[1].data))
+            free(tex->levels[1].data);
+        free(tex->levels);
+    }
+    if (!texIsInFile(tex, tex->data))
+        free(tex->data);
+    if (tex->file != NULL)
+        munmap(tex->file, tex->fileSize);
 }
 
 
 
 /*** Public: Higher-level sampling ***/
 
+/* Returns the level of detail for sampling where the texture coordinates s and 
+t change at the given rates across the screen, per pixel in x and in y. Level 
+0 is for about one texel per pixel, and each level above that is for twice as 
+many texels per pixel in each direction. */
+double texGetLOD(
+        const texTexture *tex, double dsdx, double dtdx, double dsdy, 
+        double dtdy) {
+    double dudx = dsdx * (tex->width - 1), dvdx = dtdx * (tex->height - 1);
+    double dudy = dsdy * (tex->width - 1), dvdy = dtdy * (tex->height - 1);
+    double rhoX = dudx * dudx + dvdx * dvdx, rhoY = dudy * dudy + dvdy * dvdy;
+    double rho = (rhoX > rhoY ? rhoX : rhoY);
+    /* log2 of the longer footprint, by halving that of its square. */
+    if (!(rho > 1.0))
+        return 0.0;
+    return 0.5 * log2(rho);
+}
+
+/* Samples from the texture like texSample, but at the given level of detail, 
+as from texGetLOD. With texTRILINEAR filtering, samples the two nearest mipmap 
+levels bilinearly and blends them. With texNEAREST or texLINEAR filtering, 
+samples only the nearest level. */
+void texSampleLOD(
+        const texTexture *tex, double s, double t, double lod, double sample[]) {
+    int level, k;
+    double top = tex->levelNum - 1;
+    lod = (lod > 0.0 ? lod : 0.0);
+    lod = (lod < top ? lod : top);
+    if (tex->filtering != texTRILINEAR) {
+        tex->sampler(tex, (int)round(lod), s, t, sample);
+        return;
+    }
+    level = (int)floor(lod);
+    tex->sampler(tex, level, s, t, sample);
+    if (lod > level) {
+        double frac = lod - level, upper[tex->texelDim];
+        tex->sampler(tex, level + 1, s, t, upper);
+        for (k = 0; k < tex->texelDim; k += 1)
+            sample[k] += frac * (upper[k] - sample[k]);
+    }
+}
+
+/* Samples from the texture like texSample, at the level of detail where s and 
+t change at the given rates per pixel. */
+void texSampleGrad(
+        const texTexture *tex, double s, double t, double dsdx, double dtdx, 
+        double dsdy, double dtdy, double sample[]) {
+    texSampleLOD(tex, s, t, texGetLOD(tex, dsdx, dtdx, dsdy, dtdy), sample);
+}
+
 /* Samples from the texture, taking into account wrapping and filtering. The s 
 and t parameters are texture coordinates. The texture itself is assumed to have 
 texture coordinates [0, 1] x [0, 1], with (0, 0) in the lower left corner, (1, 
 0) in the lower right corner, etc. Assumes that the texture has already been 
 initialized. Assumes that sample has been allocated with (at least) texelDim 
-doubles. Places the sampled texel into sample. */
+doubles. Places the sampled texel into sample. With texTRILINEAR filtering, 
+samples at the texture's level of detail lod, as texSampleLOD does. */
 void texSample(const texTexture *tex, double s, double t, double sample[]) {
-    /* Handle clipping vs. repeating. */
-    if (tex->leftRight == texREPEAT)
-        s = s - floor(s);
-    else {
-        if (s < 0.0)
-            s = 0.0;
-        else if (s > 1.0)
-            s = 1.0;
-    }
-    if (tex->topBottom == texREPEAT)
-        t = t - floor(t);
-    else {
-        if (t < 0.0)
-            t = 0.0;
-        else if (t > 1.0)
-            t = 1.0;
-    }
-    /* Scale to image space. */
-    double u, v;
-    u = s * (tex->width - 1);
-    v = t * (tex->height - 1);
-
-    /* Handle nearest-neighbor vs. linear filtering. */
-    if (tex->filtering == texNEAREST) {
-        texGetTexel(tex, (int)round(u), (int)round(v), sample);}
-    else {
-        double fracU = u - floor(u);
-        double fracV = v - floor(v);
+    if (tex->filtering == texTRILINEAR)
+        texSampleLOD(tex, s, t, tex->lod, sample);
+    else
+        tex->sampler(tex, 0, s, t, sample);
+}
 
-        // Get the texels which will be combined to produce the final color
-        double tlTexel[tex->texelDim], trTexel[tex->texelDim], blTexel[tex->texelDim], brTexel[tex->texelDim];
-        texGetTexel(tex, (int)floor(u), (int)ceil(v), tlTexel);
-        texGetTexel(tex, (int)ceil(u), (int)ceil(v), trTexel);
-        texGetTexel(tex, (int)floor(u), (int)floor(v), blTexel);
-        texGetTexel(tex, (int)ceil(u), (int)floor(v), brTexel);
+/* The number of samples that texSampleN wraps and scales in one pass. */
+#define texBATCHSIZE 64
+
+/* Private. Wraps the n texture coordinates s into [0, 1], as texWrap does, and 
+multiplies them by scale, into u. The loops have no branches, other than on 
+wrapping, so the compiler can vectorize them. */
+void texWrapN(int wrapping, int n, const double s[], double scale, double u[]) {
+    int i;
+    if (wrapping == texREPEAT)
+        for (i = 0; i < n; i += 1)
+            u[i] = (s[i] - floor(s[i])) * scale;
+    else
+        for (i = 0; i < n; i += 1)
+            u[i] = (s[i] < 0.0 ? 0.0 : (s[i] > 1.0 ? 1.0 : s[i])) * scale;
+}
 
-        // Scale each of these texels for a later weighted combination
-        vecScale(tex->texelDim, (1 - fracU) * fracV, tlTexel, tlTexel);
-        vecScale(tex->texelDim, fracU * fracV, trTexel, trTexel);
-        vecScale(tex->texelDim, (1 - fracU) * (1- fracV), blTexel, blTexel);
-        vecScale(tex->texelDim, fracU * (1- fracV), brTexel, brTexel);
+/* Private. Samples level 0 of a texUNORM8 texture at the n points (u[i], v[i]) 
+in its image space. As with texSampleBytesAt, linear and texelDim should be 
+constants. */
+static inline void texSampleBytesN(
+        const texTexture *tex, int linear, int texelDim, int n, 
+        const double u[], const double v[], double out[]) {
+    int i;
+    for (i = 0; i < n; i += 1)
+        texSampleBytesAt(tex, &tex->levels[0], linear, texelDim, u[i], v[i], 
+            &out[i * texelDim]);
+}
 
-        // Combine the scaled texels
-        vecAdd(tex->texelDim, tlTexel, trTexel, tlTexel);
-        vecAdd(tex->texelDim, blTexel, brTexel, blTexel);
-        vecAdd(tex->texelDim, tlTexel, blTexel, tlTexel);
-        
-        // Copy the final texel filtered texel value into the sample array
-        memcpy(sample, tlTexel, sizeof(tlTexel));
+/* Samples from the texture at the n texture coordinates (s[i], t[i]), just as 
+texSample would, placing sample number i at out[i * texelDim]. Assumes that out 
+has room for n * texelDim doubles. It is faster than calling texSample n times, 
+because it chooses how to sample once for all n. For texUNORM8 textures, 
+except with texTRILINEAR, it also wraps and scales the coordinates a batch at a 
+time, in loops that the compiler can vectorize. */
+void texSampleN(
+        const texTexture *tex, int n, const double s[], const double t[], 
+        double out[]) {
+    int i, num, texelDim = tex->texelDim, linear = (tex->filtering != texNEAREST);
+    double u[texBATCHSIZE], v[texBATCHSIZE];
+    if (tex->filtering == texTRILINEAR) {
+        for (i = 0; i < n; i += 1)
+            texSampleLOD(tex, s[i], t[i], tex->lod, &out[i * texelDim]);
+        return;
+    }
+    if (tex->format != texUNORM8) {
+        texSampler sampler = tex->sampler;
+        for (i = 0; i < n; i += 1)
+            sampler(tex, 0, s[i], t[i], &out[i * texelDim]);
+        return;
+    }
+    for (i = 0; i < n; i += texBATCHSIZE) {
+        num = (n - i < texBATCHSIZE ? n - i : texBATCHSIZE);
+        texWrapN(tex->leftRight, num, &s[i], tex->width - 1, u);
+        texWrapN(tex->topBottom, num, &t[i], tex->height - 1, v);
+        if (texelDim == 3 && linear)
+            texSampleBytesN(tex, 1, 3, num, u, v, &out[i * 3]);
+        else if (texelDim == 3)
+            texSampleBytesN(tex, 0, 3, num, u, v, &out[i * 3]);
+        else if (texelDim == 4 && linear)
+            texSampleBytesN(tex, 1, 4, num, u, v, &out[i * 4]);
+        else if (texelDim == 4)
+            texSampleBytesN(tex, 0, 4, num, u, v, &out[i * 4]);
+        else
+            texSampleBytesN(tex, linear, texelDim, num, u, v, &out[i * texelDim]);
     }
 }
-
-
@@ -3,26 +3,111 @@
 
 /*** Creating and destroying (once per program?) ***/
 
-/* Feel free to read the struct's members, but don't write them, except through 
+/* Besides the depth of every pixel, the buffer keeps a coarse hierarchy of
+depths, for rejecting occluded triangles and blocks of pixels without looking
+at their pixels. Level 0 holds the farthest depth in each 8 x 8 tile of pixels,
+and each further level holds the farthest depth in each 8 x 8 group of tiles of
+the level below, so level 1 tiles are 64 x 64 pixels. */
+#define depthLEVELNUM 2
+#define depthLEVELSHIFT 3
+
+/* The formats in which the buffer can store its depths. depthDOUBLE and
+depthFLOAT store any depth. The fixed-point formats store depths between 0 and
+1 in 24 or 16 bits, clamping any others into that range; depthUNORM24 keeps each
+depth in the low 24 bits of an unsigned int, so that it can be read and written
+whole. Smaller formats need less memory and bandwidth, but depths that are
+closer together than the format's precision can no longer be told apart. */
+#define depthDOUBLE 0
+#define depthFLOAT 1
+#define depthUNORM24 2
+#define depthUNORM16 3
+
+#define depthUNORM24MAX 16777215.0
+#define depthUNORM16MAX 65535.0
+
+/* Feel free to read the struct's members, but don't write them, except through
 the accessors below such as depthSetDepth, etc. */
 typedef struct depthBuffer depthBuffer;
 struct depthBuffer {
-	int width, height;
-	double *depths;			/* width * height doubles */
+	int width, height, format;
+	void *depths;			/* width * height values, in the format's type */
+	/* For each level, farthests[level] holds tileCols[level] * tileRows[level]
+	doubles, each at least as far as every depth in its tile. If dirties[level]
+	is set for a tile, then its farthest may be too far, and is recomputed
+	when it is next asked for. */
+	int tileCols[depthLEVELNUM], tileRows[depthLEVELNUM];
+	double *farthests[depthLEVELNUM];
+	char *dirties[depthLEVELNUM];
+	/* Clearing is lazy. A tile whose generation is not the buffer's generation
+	has not been touched since the last clear, so all of its depths are
+	clearDepth, whatever its memory holds. Its pixels (at level 0) and its
+	farthest are only filled in when a depth in it is first set. */
+	unsigned int generation;
+	unsigned int *generations[depthLEVELNUM];
+	double clearDepth;
 };
 
-/* Initializes a depth buffer. When you are finished with the buffer, you must 
+/* Private. Returns the number of bytes used to store each depth. */
+int depthGetSize(int format) {
+	if (format == depthFLOAT)
+		return sizeof(float);
+	else if (format == depthUNORM24)
+		return sizeof(unsigned int);
+	else if (format == depthUNORM16)
+		return sizeof(unsigned short);
+	else
+		return sizeof(double);
+}
+
+/* Initializes a depth buffer, storing its depths in the given format, such as
+depthDOUBLE or depthUNORM24. When you are finished with the buffer, you must
 call depthFinalize to deallocate its backing resources. */
-int depthInitialize(depthBuffer *buf, int width, int height) {
-	buf->depths = (double *)malloc(width * height * sizeof(double));
+int depthInitialize(depthBuffer *buf, int width, int height, int format) {
+	int level, shift, tileNum = 0, depthsSize, k;
+	if (format < depthDOUBLE || format > depthUNORM16) {
+		fprintf(stderr, "error: depthInitialize: unknown format %d\n", format);
+		return 2;
+	}
+	for (level = 0; level < depthLEVELNUM; level += 1) {
+		shift = depthLEVELSHIFT * (level + 1);
+		buf->tileCols[level] = (width + (1 << shift) - 1) >> shift;
+		buf->tileRows[level] = (height + (1 << shift) - 1) >> shift;
+		tileNum += buf->tileCols[level] * buf->tileRows[level];
+	}
+	/* The farthests follow the depths, so round up to keep them aligned. */
+	depthsSize = width * height * depthGetSize(format);
+	depthsSize = (depthsSize + sizeof(double) - 1) / sizeof(double) *
+		sizeof(double);
+	buf->depths = malloc(depthsSize + tileNum * (sizeof(double) +
+		sizeof(unsigned int) + sizeof(char)));
 	if (buf->depths != NULL) {
 		buf->width = width;
 		buf->height = height;
+		buf->format = format;
+		double *farthests = (double *)((char *)buf->depths + depthsSize);
+		unsigned int *generations = (unsigned int *)&farthests[tileNum];
+		char *dirties = (char *)&generations[tileNum];
+		for (level = 0; level < depthLEVELNUM; level += 1) {
+			buf->farthests[level] = farthests;
+			buf->generations[level] = generations;
+			buf->dirties[level] = dirties;
+			farthests += buf->tileCols[level] * buf->tileRows[level];
+			generations += buf->tileCols[level] * buf->tileRows[level];
+			dirties += buf->tileCols[level] * buf->tileRows[level];
+		}
+		/* The buffer starts out cleared to the farthest depth it can hold, as
+		depthClearDepths(buf, HUGE_VAL) would leave it. */
+		for (level = 0; level < depthLEVELNUM; level += 1)
+			for (k = 0; k < buf->tileCols[level] * buf->tileRows[level]; k += 1)
+				buf->generations[level][k] = 0;
+		buf->generation = 1;
+		buf->clearDepth = (format == depthDOUBLE || format == depthFLOAT ?
+			HUGE_VAL : 1.0);
 	}
 	return (buf->depths == NULL);
 }
 
-/* Deallocates the resources backing the buffer. This function must be called 
+/* Deallocates the resources backing the buffer. This function must be called
 when you are finished using a buffer. */
 void depthFinalize(depthBuffer *buf) {
 	free(buf->depths);
@@ -32,28 +117,215 @@ void depthFinalize(depthBuffer *buf) {
 
 /*** Regular use (on each frame) ***/
 
-/* Sets every depth-value to the given depth. Typically you use this function 
-at the start of each frame, passing a large positive value for depth. */
+/* Private. Converts a depth to the 24-bit or 16-bit fixed-point format, whose
+largest value is max. */
+unsigned int depthEncodeUnorm(double depth, double max) {
+	if (!(depth > 0.0))
+		return 0;
+	else if (depth >= 1.0)
+		return (unsigned int)max;
+	else
+		return (unsigned int)(depth * max + 0.5);
+}
+
+/* Private. Returns the depth stored at index k of the depths, as a double. */
+double depthDecode(const depthBuffer *buf, int k) {
+	if (buf->format == depthDOUBLE)
+		return ((double *)buf->depths)[k];
+	else if (buf->format == depthFLOAT)
+		return ((float *)buf->depths)[k];
+	else if (buf->format == depthUNORM24)
+		return ((unsigned int *)buf->depths)[k] / depthUNORM24MAX;
+	else
+		return ((unsigned short *)buf->depths)[k] / depthUNORM16MAX;
+}
+
+/* Private. Returns the index of the tile of the given level containing pixel
+(i, j). */
+int depthGetTile(const depthBuffer *buf, int level, int i, int j) {
+	int shift = depthLEVELSHIFT * (level + 1);
+	return (i >> shift) + buf->tileCols[level] * (j >> shift);
+}
+
+/* Private. Fills the pixels of level-0 tile number tile with the clear depth,
+which is why it has to be called before a pixel in a cleared tile is set. */
+void depthFillTile(depthBuffer *buf, int tile) {
+	int size = 1 << depthLEVELSHIFT, i, j;
+	int iMin = (tile % buf->tileCols[0]) * size;
+	int jMin = (tile / buf->tileCols[0]) * size;
+	int iMax = (iMin + size < buf->width ? iMin + size : buf->width);
+	int jMax = (jMin + size < buf->height ? jMin + size : buf->height);
+	/* Encode the clear depth once, and then copy it with one loop per format. */
+	if (buf->format == depthDOUBLE) {
+		double *depths = (double *)buf->depths, depth = buf->clearDepth;
+		for (j = jMin; j < jMax; j += 1)
+			for (i = iMin; i < iMax; i += 1)
+				depths[i + (long)buf->width * j] = depth;
+	} else if (buf->format == depthFLOAT) {
+		float *depths = (float *)buf->depths, depth = buf->clearDepth;
+		for (j = jMin; j < jMax; j += 1)
+			for (i = iMin; i < iMax; i += 1)
+				depths[i + (long)buf->width * j] = depth;
+	} else if (buf->format == depthUNORM24) {
+		unsigned int *depths = (unsigned int *)buf->depths;
+		unsigned int depth = depthEncodeUnorm(buf->clearDepth, depthUNORM24MAX);
+		for (j = jMin; j < jMax; j += 1)
+			for (i = iMin; i < iMax; i += 1)
+				depths[i + (long)buf->width * j] = depth;
+	} else {
+		unsigned short *depths = (unsigned short *)buf->depths;
+		unsigned short depth = depthEncodeUnorm(buf->clearDepth, depthUNORM16MAX);
+		for (j = jMin; j < jMax; j += 1)
+			for (i = iMin; i < iMax; i += 1)
+				depths[i + (long)buf->width * j] = depth;
+	}
+}
+
+/* Sets every depth-value to the given depth. Typically you use this function
+at the start of each frame, passing a large positive value for depth. Only a
+few numbers are written here. Each 8 x 8 tile of pixels is filled in when a
+depth in it is first set, so tiles that nothing is drawn to cost nothing. */
 void depthClearDepths(depthBuffer *buf, double depth) {
-	int i, j;
-	for (i = 0; i < buf->width; i += 1)
-		for (j = 0; j < buf->height; j += 1)
-			buf->depths[i + buf->width * j] = depth;
+	int k, level;
+	/* Store the depth as the buffer's format would round it. */
+	if (buf->format == depthFLOAT)
+		depth = (float)depth;
+	else if (buf->format == depthUNORM24)
+		depth = depthEncodeUnorm(depth, depthUNORM24MAX) / depthUNORM24MAX;
+	else if (buf->format == depthUNORM16)
+		depth = depthEncodeUnorm(depth, depthUNORM16MAX) / depthUNORM16MAX;
+	buf->clearDepth = depth;
+	buf->generation += 1;
+	if (buf->generation == 0) {
+		/* After four billion clears, the old generations could come back. */
+		for (level = 0; level < depthLEVELNUM; level += 1)
+			for (k = 0; k < buf->tileCols[level] * buf->tileRows[level]; k += 1)
+				buf->generations[level][k] = 0;
+		buf->generation = 1;
+	}
+}
+
+/* Private. Returns whether depth is nearer than stored, which is a depth
+that the buffer's format can hold exactly, once depth is rounded to that
+format. */
+int depthIsNearerThan(const depthBuffer *buf, double depth, double stored) {
+	if (buf->format == depthDOUBLE)
+		return depth < stored;
+	else if (buf->format == depthFLOAT)
+		return (float)depth < (float)stored;
+	else if (buf->format == depthUNORM24)
+		return depthEncodeUnorm(depth, depthUNORM24MAX) <
+			depthEncodeUnorm(stored, depthUNORM24MAX);
+	else
+		return depthEncodeUnorm(depth, depthUNORM16MAX) <
+			depthEncodeUnorm(stored, depthUNORM16MAX);
 }
 
-/* Sets the depth-value at pixel (i, j) to the given depth. */
+/* Returns whether the given depth is nearer than the depth-value at pixel
+(i, j), comparing them in the buffer's format. So it is the depth test, but
+rounded the same way that depthSetDepth would round the depth. */
+int depthIsNearer(const depthBuffer *buf, int i, int j, double depth) {
+	int k = i + buf->width * j;
+	if (0 <= i && i < buf->width && 0 <= j && j < buf->height) {
+		if (buf->generations[0][depthGetTile(buf, 0, i, j)] != buf->generation)
+			return depthIsNearerThan(buf, depth, buf->clearDepth);
+		else if (buf->format == depthDOUBLE)
+			return depth < ((double *)buf->depths)[k];
+		else if (buf->format == depthFLOAT)
+			return (float)depth < ((float *)buf->depths)[k];
+		else if (buf->format == depthUNORM24)
+			return depthEncodeUnorm(depth, depthUNORM24MAX) <
+				((unsigned int *)buf->depths)[k];
+		else
+			return depthEncodeUnorm(depth, depthUNORM16MAX) <
+				((unsigned short *)buf->depths)[k];
+	} else
+		return 0;
+}
+
+/* Sets the depth-value at pixel (i, j) to the given depth, rounded to the
+buffer's format. */
 void depthSetDepth(depthBuffer *buf, int i, int j, double depth) {
-	if (0 <= i && i < buf->width && 0 <= j && j < buf->height)
-		buf->depths[i + buf->width * j] = depth;
+	int k = i + buf->width * j, level, tile;
+	double old;
+	if (0 <= i && i < buf->width && 0 <= j && j < buf->height) {
+		/* The first depth set in a tile since the last clear fills it in. */
+		for (level = 0; level < depthLEVELNUM; level += 1) {
+			tile = depthGetTile(buf, level, i, j);
+			if (buf->generations[level][tile] != buf->generation) {
+				if (level == 0)
+					depthFillTile(buf, tile);
+				buf->farthests[level][tile] = buf->clearDepth;
+				buf->dirties[level][tile] = 0;
+				buf->generations[level][tile] = buf->generation;
+			}
+		}
+		old = depthDecode(buf, k);
+		if (buf->format == depthDOUBLE)
+			((double *)buf->depths)[k] = depth;
+		else if (buf->format == depthFLOAT)
+			((float *)buf->depths)[k] = depth;
+		else if (buf->format == depthUNORM24)
+			((unsigned int *)buf->depths)[k] =
+				depthEncodeUnorm(depth, depthUNORM24MAX);
+		else
+			((unsigned short *)buf->depths)[k] =
+				depthEncodeUnorm(depth, depthUNORM16MAX);
+		depth = depthDecode(buf, k);
+		/* Moving farther raises a tile's farthest right away. Moving nearer
+		from the farthest depth might lower it, which is left for later. */
+		for (level = 0; level < depthLEVELNUM; level += 1) {
+			tile = depthGetTile(buf, level, i, j);
+			if (depth > buf->farthests[level][tile])
+				buf->farthests[level][tile] = depth;
+			else if (old == buf->farthests[level][tile] && depth < old)
+				buf->dirties[level][tile] = 1;
+		}
+	}
 }
 
 /* Returns the depth-value at pixel (i, j). */
 double depthGetDepth(const depthBuffer *buf, int i, int j) {
-	if (0 <= i && i < buf->width && 0 <= j && j < buf->height)
-		return buf->depths[i + buf->width * j];
-	else
+	if (0 <= i && i < buf->width && 0 <= j && j < buf->height) {
+		if (buf->generations[0][depthGetTile(buf, 0, i, j)] != buf->generation)
+			return buf->clearDepth;
+		return depthDecode(buf, i + buf->width * j);
+	} else
 		/* There's no right answer, but we have to return something. */
 		return 0.0;
 }
 
-
+/* Returns a depth at least as far as every depth-value in tile (col, row) of
+the given level. Level 0 tiles are 8 x 8 pixels, and level 1 tiles are 64 x 64
+pixels, both starting from pixel (0, 0). A triangle whose depths are all at
+least this far is completely hidden in that tile. Tiles never straddle a
+multiple of 64 pixels, so threads that each own 64 x 64 tiles of the screen
+can call this safely on their own tiles. The renderer's renTILESIZE is derived 
+from depthLEVELSHIFT and depthLEVELNUM to keep that so. */
+double depthGetFarthest(depthBuffer *buf, int level, int col, int row) {
+	int tile = col + buf->tileCols[level] * row;
+	if (buf->generations[level][tile] != buf->generation)
+		return buf->clearDepth;
+	if (buf->dirties[level][tile]) {
+		double farthest = -HUGE_VAL, depth;
+		int size = 1 << depthLEVELSHIFT, i, j;
+		if (level == 0) {
+			for (j = row * size; j < (row + 1) * size && j < buf->height; j += 1)
+				for (i = col * size; i < (col + 1) * size && i < buf->width; i += 1) {
+					depth = depthDecode(buf, i + buf->width * j);
+					if (depth > farthest)
+						farthest = depth;
+				}
+		} else {
+			for (j = row * size; j < (row + 1) * size && j < buf->tileRows[level - 1]; j += 1)
+				for (i = col * size; i < (col + 1) * size && i < buf->tileCols[level - 1]; i += 1) {
+					depth = depthGetFarthest(buf, level - 1, i, j);
+					if (depth > farthest)
+						farthest = depth;
+				}
+		}
+		buf->farthests[level][tile] = farthest;
+		buf->dirties[level][tile] = 0;
+	}
+	return buf->farthests[level][tile];
+}
@@ -1,14 +1,58 @@
 // Nathaniel Li
 
+/* These are the two values of depthMode. With shaLATEDEPTH, every covered pixel 
+is passed to shadeFragment, and the depth that it outputs in rgbd[3] is tested 
+against the depth buffer. With shaEARLYDEPTH, the pipeline first tests the 
+interpolated screen-space depth vary[2] and skips shadeFragment for occluded 
+pixels. Shaders that output any depth other than vary[2] must use 
+shaLATEDEPTH. */
+#define shaLATEDEPTH 0
+#define shaEARLYDEPTH 1
+
+/* These are the three values of cullMode. The pipeline tests each triangle's 
+winding right after vertex shading, in clip space, so that culled triangles are 
+never clipped or set up. Triangles that are counterclockwise on screen face the 
+camera. shaCULLBACK is 0, so that a zeroed shading culls back faces, as the 
+pipeline always did before cullMode existed. */
+#define shaCULLBACK 0
+#define shaCULLNONE 1
+#define shaCULLFRONT 2
+
 typedef struct shaShading shaShading;
 
+/* The first four entries of vary are assumed to be X, Y, Z, W. shadeVertices is 
+optional; set it to NULL if the shader doesn't have it. If present, it must 
+compute the same varyings as shadeVertex, but for vertNum vertices at once, laid 
+out as streams: attrs[k][v] is attribute k of vertex v, and varys[k][v] is 
+varying k of vertex v. Each stream starts on a 64-byte boundary. Then the 
+pipeline calls it instead of shadeVertex, once per batch of vertices. If 
+texCoordIndex is at least 4, then the texture coordinates s and t are 
+vary[texCoordIndex] and vary[texCoordIndex + 1]. The rasterizer then measures 
+how fast they change across the screen, and passes shadeFragment copies of the 
+textures whose lod is set accordingly, so that texSample with texTRILINEAR 
+picks suitable mipmap levels. Since X, Y, Z, W come first, any smaller value, 
+such as the 0 of a zeroed shading, means that the textures are passed as is. 
+shadeFragments is optional too. If present, it must compute the same rgbd as 
+shadeFragment, but for fragNum fragments at once, as streams: varys[k][f] is 
+varying k of fragment f, and rgbds[k][f] receives channel k of its rgbd. Then 
+deferred shading calls it instead of shadeFragment, with the textures as is, 
+whenever no lod is needed, because texCoordIndex is less than 4 or no texture 
+is filtered with texTRILINEAR. So it can sample a texture for many fragments 
+at once, as texSampleN does. */
 struct shaShading {
     int unifDim;
     int attrDim;
     int texNum;
     int varyDim;
+    int depthMode;
+    int cullMode;
+    int texCoordIndex;
     void (*shadeVertex) (int unifDim, const double unif[], int attrDim, const double attr[], 
         int varyDim, double vary[]);
+    void (*shadeVertices) (int vertNum, int unifDim, const double unif[], int attrDim, 
+        const double *attrs[], int varyDim, double *varys[]);
     void (*shadeFragment) (int unifDim, const double unif[], int texNum, const texTexture *tex[], 
         int varyDim, const double vary[], double rgbd[4]);
-};
\ No newline at end of file
+    void (*shadeFragments) (int fragNum, int unifDim, const double unif[], int texNum, 
+        const texTexture *tex[], int varyDim, const double *varys[], double *rgbds[]);
+};
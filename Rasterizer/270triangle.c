@@ -16,144 +16,618 @@ int max(int a, int b) {
     return a;
 }
 
-/* Returns the Y value the inner loop of rasterization should start from
-   Makes sure the the loop does not continue outside the bounds of the window */
-int getYLoopStart(const double v1[], const double v2[], int x) {
-    int y = ceil(v1[1] + (v2[1] - v1[1])/(v2[0] - v1[0]) * (x - v1[0]));
-    if (y > 0) {
-        return y;
+/* Triangles are rasterized in triBLOCKSIZE x triBLOCKSIZE blocks of pixels, 
+aligned to multiples of triBLOCKSIZE on the screen. The blocks are the depth 
+buffer's level-0 tiles. */
+#define triBLOCKSIZE (1 << depthLEVELSHIFT)
+#define triNEGATIVEDENORMAL -4.9406564584124654e-324
+
+/* An edge function E(x, y) = E0 + A (x - x0) + B (y - y0), oriented so that it 
+is positive inside the triangle. */
+typedef struct triEdge triEdge;
+struct triEdge {
+    double x0, y0, a, b;
+    int topLeft;            /* whether pixels exactly on the edge are drawn */
+    double threshold;       /* pixels are inside when E > threshold */
+};
+
+/* Sets up the edge function for the directed edge from v to w, for a triangle 
+that is counterclockwise, so that its inside is to the left of the edge. The 
+function is always computed from the lexicographically lesser endpoint, so that 
+two triangles sharing the edge get exactly opposite values on it. The top-left 
+rule then gives each pixel on the shared edge to exactly one of them. */
+void triEdgeSetup(const double v[], const double w[], triEdge *edge) {
+    double dx = w[0] - v[0], dy = w[1] - v[1];
+    if (v[0] < w[0] || (v[0] == w[0] && v[1] < w[1])) {
+        edge->x0 = v[0];
+        edge->y0 = v[1];
+        edge->a = -dy;
+        edge->b = dx;
+    } else {
+        /* Compute from w, as the edge from w to v would, and flip the sign. */
+        edge->x0 = w[0];
+        edge->y0 = w[1];
+        edge->a = v[1] - w[1];
+        edge->b = -(v[0] - w[0]);
     }
-    return 0;
+    edge->topLeft = (dy < 0.0 || (dy == 0.0 && dx < 0.0));
+    /* No double lies strictly between 0 and triNEGATIVEDENORMAL, the largest 
+    negative double, so E > threshold means E >= 0 on top-left edges and E > 0 
+    on the others. */
+    edge->threshold = (edge->topLeft ? triNEGATIVEDENORMAL : 0.0);
+}
+
+/* Evaluates the edge function at pixel (x, y). */
+double triEdgeEvaluate(const triEdge *edge, int x, int y) {
+    return edge->a * (x - edge->x0) + edge->b * (y - edge->y0);
+}
+
+/* Counts of what happened to the pixels covered by rasterized triangles. The 
+fragment shader ran shadedNum times, and earlyRejectNum invocations were 
+avoided by the early depth test. passedNum pixels passed the depth test and were 
+written, so passedNum divided by the number of pixels on the screen is the 
+overdraw. Before that, hiddenTriangleNum triangles and 
+hiddenBlockNum blocks of pixels were skipped by the depth buffer's coarse 
+levels, and their pixels are not counted at all. Feel free to read and write 
+these members. */
+typedef struct triCounters triCounters;
+struct triCounters {
+    long coveredNum, earlyRejectNum, shadedNum, passedNum;
+    long hiddenTriangleNum, hiddenBlockNum;
+};
+
+/* Sets all of the counts to zero. */
+void triClearCounters(triCounters *counters) {
+    counters->coveredNum = 0;
+    counters->earlyRejectNum = 0;
+    counters->shadedNum = 0;
+    counters->passedNum = 0;
+    counters->hiddenTriangleNum = 0;
+    counters->hiddenBlockNum = 0;
+}
+
+/* Adds the counts in more to the counts in counters. */
+void triAddCounters(triCounters *counters, const triCounters *more) {
+    counters->coveredNum += more->coveredNum;
+    counters->earlyRejectNum += more->earlyRejectNum;
+    counters->shadedNum += more->shadedNum;
+    counters->passedNum += more->passedNum;
+    counters->hiddenTriangleNum += more->hiddenTriangleNum;
+    counters->hiddenBlockNum += more->hiddenBlockNum;
 }
 
-/* Returns the Y value the inner loop of rasterization should end at
-   Makes sure the the loop does not continue outside the bounds of the window */
-int getYLoopEnd(int bufHeight, const double v1[], const double v2[], int x) {
-    int y = floor(v1[1] + (v2[1]  - v1[1]) / (v2[0] - v1[0]) * (x - v1[0]));
-    if (y < bufHeight) {
-        return y;
+/* Returns whether a triangle, whose depths within the pixels from (xMin, yMin) 
+to (xMax, yMax) are all at least zNear, is hidden behind what the depth buffer 
+already holds there. Checks the level-1 tiles, which are cheap and few. */
+int triIsHidden(depthBuffer *buf, double zNear, int xMin, int xMax, int yMin, int yMax) {
+    int shift = 2 * depthLEVELSHIFT;
+    for (int row = yMin >> shift; row <= yMax >> shift; row++) {
+        for (int col = xMin >> shift; col <= xMax >> shift; col++) {
+            if (zNear < depthGetFarthest(buf, 1, col, row)) {
+                return 0;
+            }
+        }
     }
-    return bufHeight;
+    return 1;
 }
 
-void findPixelColor(
-        const shaShading *sha, depthBuffer *buf, const double unif[], const texTexture *tex[],
-        const double a[], const double b[], const double c[], double mInverse[][2], int x, int y) {
-    
-    // Below code produces a vector containing the "p and q" values in vectorBlend
-    double pixelPos[2] = {x, y};
-    double axVector[2];
-    vecSubtract(2, pixelPos, a, axVector);
-    double vectorBlend[2]; 
-    mat221Multiply(mInverse, axVector, vectorBlend);
+/* Computes the rates at which varying i changes across the triangle a, b, c, 
+per pixel in x (grad[0]) and in y (grad[1]). They are 0 if the triangle is 
+degenerate. */
+void triGetGradient(
+        const double a[], const double b[], const double c[], int i, double grad[2]) {
+    double det = (b[0] - a[0]) * (c[1] - a[1]) - (c[0] - a[0]) * (b[1] - a[1]);
+    if (det == 0.0) {
+        grad[0] = 0.0;
+        grad[1] = 0.0;
+        return;
+    }
+    grad[0] = ((b[i] - a[i]) * (c[1] - a[1]) - (c[i] - a[i]) * (b[1] - a[1])) / det;
+    grad[1] = ((c[i] - a[i]) * (b[0] - a[0]) - (b[i] - a[i]) * (c[0] - a[0])) / det;
+}
 
-    // Varying vector. 
-    double vary[sha->varyDim];
-    for (int i = 0; i < sha->varyDim; i++) {
-        vary[i] = a[i] + vectorBlend[0] * (b[i] - a[i]) + vectorBlend[1] * (c[i] - a[i]);
+/* Copies the texNum textures into views, setting each copy's lod for texture 
+coordinates s and t whose gradients are dS and dT, and points viewPtrs at the 
+copies. */
+void triSetLODs(
+        int texNum, const texTexture *tex[], const double dS[2], const double dT[2], 
+        texTexture views[], const texTexture *viewPtrs[]) {
+    for (int k = 0; k < texNum; k++) {
+        views[k] = *tex[k];
+        views[k].lod = texGetLOD(tex[k], dS[0], dT[0], dS[1], dT[1]);
+        viewPtrs[k] = &views[k];
     }
+}
+
+/* The flags returned by findPixelColor. */
+#define triSHADED 1
+#define triPASSED 2
 
+/* Shades the pixel (x, y) with the interpolated varyings, and draws it if it 
+passes the depth test. Returns triSHADED if the fragment shader ran, plus 
+triPASSED if the pixel was drawn, or 0 if the early depth test rejected the 
+pixel first. If gbuf is not NULL, then the shading is deferred: the pixel is 
+tested with its interpolated depth, as with shaEARLYDEPTH, and if it passes, 
+its varyings, and the texture coordinates' gradients grads unless they are 
+NULL, are stored in gbuf, which must be in the gbufVARYINGS format, instead of 
+being shaded. */
+int findPixelColor(
+        const shaShading *sha, frameBuffer *frame, gbufBuffer *gbuf, depthBuffer *buf, 
+        const double unif[], const texTexture *tex[], const double vary[], 
+        const double grads[4], int x, int y) {
     double rgbd[4];
+
+    // With deferred shading, keep the varyings of the nearest fragment for later
+    if (gbuf != NULL) {
+        if (!depthIsNearer(buf, x, y, vary[2])) {
+            return 0;
+        }
+        gbufSetVaryings(gbuf, x, y, sha->varyDim, vary, grads);
+        depthSetDepth(buf, x, y, vary[2]);
+        return triPASSED;
+    }
+
+    // With early depth, skip the fragment shader for pixels that are already occluded
+    if (sha->depthMode == shaEARLYDEPTH) {
+        if (!depthIsNearer(buf, x, y, vary[2])) {
+            return 0;
+        }
+        sha->shadeFragment(sha->unifDim, unif, sha->texNum, tex, sha->varyDim, vary, rgbd);
+        frameSetRGB(frame, x, y, rgbd[0], rgbd[1], rgbd[2]);
+        depthSetDepth(buf, x, y, vary[2]);
+        return triSHADED | triPASSED;
+    }
     
     // Pass varying vector to the fragment shader
     sha->shadeFragment(sha->unifDim, unif, sha->texNum, tex, sha->varyDim, vary, rgbd);
 
     // Do not draw the pixel if it is occluded by another
-    if (rgbd[3] < depthGetDepth(buf, x, y)) {
-        pixSetRGB(x, y, rgbd[0], rgbd[1], rgbd[2]);
+    if (depthIsNearer(buf, x, y, rgbd[3])) {
+        frameSetRGB(frame, x, y, rgbd[0], rgbd[1], rgbd[2]);
         depthSetDepth(buf, x, y, rgbd[3]);
+        return triSHADED | triPASSED;
     }
+    return triSHADED;
 }
 
-/* Renders a triangle assuming that A is the leftmost point */
-void triRenderALeft( 
-        const shaShading *sha, depthBuffer *buf, const double unif[], const texTexture *tex[], 
-        const double a[], const double b[], const double c[]) {
-    
-    // Check if the triangle is facing the camera and do not render it if it is not.
-    double m[2][2] = {
-        {b[0] - a[0], c[0] - a[0]},
-        {b[1] - a[1], c[1] - a[1]}};
-    double mInverse[2][2];
-    if (mat22Invert(m, mInverse) <= 0) {
+/* For a visibility buffer. Tests the pixel (x, y) with its interpolated depth 
+z, and if it passes, stores triangle number tri there, with weights p and q. 
+Returns triPASSED if the pixel was drawn, or 0 if it was rejected. */
+int findPixelVisibility(
+        gbufBuffer *gbuf, depthBuffer *buf, int tri, double p, double q, double z, 
+        int x, int y) {
+    if (!depthIsNearer(buf, x, y, z)) {
+        return 0;
+    }
+    gbufSetVisibility(gbuf, x, y, tri, p, q);
+    depthSetDepth(buf, x, y, z);
+    return triPASSED;
+}
+
+/* Like triRender, but only touches pixels inside the scissor rectangle 
+{xMin, xMax, yMin, yMax} (inclusive), which should lie within the buffer. Used 
+by the tiled renderer, so that each tile can be rasterized on its own. Every 
+pixel's edge values and varyings are stepped from the corner of its block, so 
+as long as xMin and yMin are multiples of triBLOCKSIZE, the output is the same 
+however the screen is split up. */
+void triRenderScissor(
+        const shaShading *sha, frameBuffer *frame, gbufBuffer *gbuf, depthBuffer *buf, 
+        const double unif[], const texTexture *tex[], const double a[], const double b[], 
+        const double c[], int tri, const int scissor[4], triCounters *counters) {
+    /* A visibility buffer needs only the depth, so only X, Y, Z are stepped. */
+    int visible = (gbuf != NULL && gbuf->format == gbufVISIBILITY);
+    int varyDim = (visible ? 3 : sha->varyDim), swapped = 0;
+
+    /* Face culling is done by the pipeline, according to sha->cullMode, before 
+    clipping. Here clockwise triangles are just reordered to be counterclockwise, 
+    and only degenerate ones are dropped. */
+    double det = (b[0] - a[0]) * (c[1] - a[1]) - (c[0] - a[0]) * (b[1] - a[1]);
+    if (det < 0.0) {
+        const double *swap = b;
+        b = c;
+        c = swap;
+        det = -det;
+        swapped = 1;
+    }
+    if (!(det > 0.0)) {
         return;
     }
 
-    double finalRgb[3];
+    // Bounding box of the triangle, clipped to the scissor rectangle
+    double xLow = a[0], xHigh = a[0], yLow = a[1], yHigh = a[1];
+    xLow = (b[0] < xLow ? b[0] : xLow);
+    xLow = (c[0] < xLow ? c[0] : xLow);
+    xHigh = (b[0] > xHigh ? b[0] : xHigh);
+    xHigh = (c[0] > xHigh ? c[0] : xHigh);
+    yLow = (b[1] < yLow ? b[1] : yLow);
+    yLow = (c[1] < yLow ? c[1] : yLow);
+    yHigh = (b[1] > yHigh ? b[1] : yHigh);
+    yHigh = (c[1] > yHigh ? c[1] : yHigh);
+    if (xLow > scissor[1] || xHigh < scissor[0] || yLow > scissor[3] || yHigh < scissor[2]) {
+        return;
+    }
+    int xMin = max(scissor[0], ceil(xLow)), xMax = min(scissor[1], floor(xHigh));
+    int yMin = max(scissor[2], ceil(yLow)), yMax = min(scissor[3], floor(yHigh));
+    if (xMin > xMax || yMin > yMax) {
+        return;
+    }
 
-    /* This means C is in between A and B, horizontally */
-    if (c[0] <= b[0]) {
-        /* Check and account for vertical lines in the triangle */
-        if (c[0] == a[0]) {
-            for (int x = max(0, ceil(a[0])); x <= min(buf->width, floor(b[0])); x++) {
-                for (int y = getYLoopStart(a, b, x); y <= getYLoopEnd(buf->height, b, c, x); y++) {
-                        findPixelColor(sha, buf, unif, tex, a, b, c, mInverse, x, y);
-                }
-            }
+    /* Edge 0 is opposite A, edge 1 is opposite B, and edge 2 is opposite C, so 
+    that their values divided by det are the barycentric weights of A, B, C. */
+    triEdge edges[3];
+    triEdgeSetup(b, c, &edges[0]);
+    triEdgeSetup(c, a, &edges[1]);
+    triEdgeSetup(a, b, &edges[2]);
+
+    /* The varyings are vary = a + p (b - a) + q (c - a), where p and q are the 
+    weights of B and C. They change by these constant amounts per pixel in x. */
+    double detInverse = 1.0 / det;
+    double bMinusA[varyDim], cMinusA[varyDim], dVarydX[varyDim];
+    vecSubtract(varyDim, b, a, bMinusA);
+    vecSubtract(varyDim, c, a, cMinusA);
+    for (int i = 0; i < varyDim; i++) {
+        dVarydX[i] = (edges[1].a * bMinusA[i] + edges[2].a * cMinusA[i]) * detInverse;
+    }
+
+    /* With early depth or deferred shading, the depth buffer's coarse levels 
+    can show that the whole triangle, or a whole block of it, is hidden. The 
+    depth is linear in x and y, so its nearest value over a block is at one 
+    corner. zMargin absorbs rounding between these bounds and the per-pixel 
+    depths. */
+    int hierarchical = (sha->depthMode == shaEARLYDEPTH || gbuf != NULL);
+    double zNear = a[2], dZdX = 0.0, dZdY = 0.0, zMargin = 0.0;
+    if (hierarchical) {
+        zNear = (b[2] < zNear ? b[2] : zNear);
+        zNear = (c[2] < zNear ? c[2] : zNear);
+        zMargin = 1.0e-9 * (1.0 + fabs(zNear));
+        if (triIsHidden(buf, zNear - zMargin, xMin, xMax, yMin, yMax)) {
+            counters->hiddenTriangleNum += 1;
+            return;
         }
-        else if (c[0] == b[0]) {
-            for (int x = max(0, ceil(a[0])); x <= floor(c[0]); x++) {
-                for (int y = getYLoopStart(a, b, x); y <= getYLoopEnd(buf-> height, a, c, x); y++) {
-                        findPixelColor(sha, buf, unif, tex, a, b, c, mInverse, x, y);
+        dZdX = dVarydX[2];
+        dZdY = (edges[1].b * bMinusA[2] + edges[2].b * cMinusA[2]) * detInverse;
+        dZdX = (dZdX < 0.0 ? dZdX : 0.0) * (triBLOCKSIZE - 1);
+        dZdY = (dZdY < 0.0 ? dZdY : 0.0) * (triBLOCKSIZE - 1);
+    }
+
+    /* A block can be skipped if some edge function is negative all over it. 
+    The margin absorbs rounding between this test and the per-pixel values. */
+    double reach[3], margin[3];
+    for (int k = 0; k < 3; k++) {
+        reach[k] = ((edges[k].a > 0.0 ? edges[k].a : 0.0) + 
+            (edges[k].b > 0.0 ? edges[k].b : 0.0)) * (triBLOCKSIZE - 1);
+        margin[k] = (fabs(edges[k].a) + fabs(edges[k].b)) * 1.0e-6;
+    }
+
+    // Choose the textures' mipmap levels from the texture coordinates' gradients
+    int texNum = (sha->texNum > 0 ? sha->texNum : 1);
+    texTexture views[texNum];
+    const texTexture *viewPtrs[texNum];
+    double grads[4];
+    const double *lodGrads = NULL;
+    if (!visible && sha->texCoordIndex >= 4 && sha->texNum > 0) {
+        triGetGradient(a, b, c, sha->texCoordIndex, &grads[0]);
+        triGetGradient(a, b, c, sha->texCoordIndex + 1, &grads[2]);
+        triSetLODs(sha->texNum, tex, &grads[0], &grads[2], views, viewPtrs);
+        tex = viewPtrs;
+        lodGrads = grads;
+    }
+
+    double vary[varyDim], e[3], eRow[3];
+    long coveredNum = 0, shadedNum = 0, passedNum = 0;
+    int xBlockMin = xMin - xMin % triBLOCKSIZE, yBlockMin = yMin - yMin % triBLOCKSIZE;
+    for (int yBlock = yBlockMin; yBlock <= yMax; yBlock += triBLOCKSIZE) {
+        for (int xBlock = xBlockMin; xBlock <= xMax; xBlock += triBLOCKSIZE) {
+            int empty = 0;
+            for (int k = 0; k < 3; k++) {
+                e[k] = triEdgeEvaluate(&edges[k], xBlock, yBlock);
+                if (e[k] + reach[k] < -margin[k]) {
+                    empty = 1;
                 }
             }
-        }
-        /* Triangle has no vertical lines, so it must be rendered in halves */
-        else {
-            for (int x = max(0, ceil(a[0])); x <= min(buf->width, floor(c[0])); x++) {
-                for (int y = getYLoopStart(a, b, x); y <= getYLoopEnd(buf-> height, a, c, x); y++) {
-                        findPixelColor(sha, buf, unif, tex, a, b, c, mInverse, x, y);
-                }
+            if (empty) {
+                continue;
             }
-            for (int x = max(0, floor(c[0]) + 1); min(buf->width, x <= floor(b[0])); x++) {
-                for (int y = getYLoopStart(a, b, x); y <= getYLoopEnd(buf-> height, b, c, x); y++) {
-                        findPixelColor(sha, buf, unif, tex, a, b, c, mInverse, x, y);
+            if (hierarchical) {
+                double zBlock = a[2] + e[1] * detInverse * bMinusA[2] + 
+                    e[2] * detInverse * cMinusA[2] + dZdX + dZdY;
+                zBlock = (zBlock > zNear ? zBlock : zNear) - zMargin;
+                if (zBlock >= depthGetFarthest(buf, 0, xBlock >> depthLEVELSHIFT, 
+                        yBlock >> depthLEVELSHIFT)) {
+                    counters->hiddenBlockNum += 1;
+                    continue;
                 }
             }
-        } 
-    }
-    /* B is in between A and C */
-    else  {
-        /* Check and account for vertical lines in the triangle */
-        if (a[0] == b[0]) {
-            for (int x = max(0, ceil(a[0])); x <= min(buf->width, floor(c[0])); x++) {
-                for (int y = getYLoopStart(c, b, x); y <= getYLoopEnd(buf-> height, a, c, x); y++) {
-                        findPixelColor(sha, buf, unif, tex, a, b, c, mInverse, x, y);
+            int xStart = max(xBlock, xMin), xEnd = min(xBlock + triBLOCKSIZE - 1, xMax);
+            int yStart = max(yBlock, yMin), yEnd = min(yBlock + triBLOCKSIZE - 1, yMax);
+            for (int y = yStart; y <= yEnd; y++) {
+                for (int k = 0; k < 3; k++) {
+                    eRow[k] = e[k] + (y - yBlock) * edges[k].b + (xStart - xBlock) * edges[k].a;
+                }
+                /* The covered pixels of a row form one span. The varyings are 
+                set up at its first pixel and then stepped along it. */
+                int covered = 0;
+                for (int x = xStart; x <= xEnd; x++) {
+                    if (eRow[0] > edges[0].threshold && eRow[1] > edges[1].threshold && 
+                            eRow[2] > edges[2].threshold) {
+                        if (!covered) {
+                            double p = eRow[1] * detInverse, q = eRow[2] * detInverse;
+                            for (int i = 0; i < varyDim; i++) {
+                                vary[i] = a[i] + p * bMinusA[i] + q * cMinusA[i];
+                            }
+                            covered = 1;
+                        } else {
+                            vecAdd(varyDim, vary, dVarydX, vary);
+                        }
+                        coveredNum += 1;
+                        int flags;
+                        if (visible) {
+                            double p = eRow[1] * detInverse, q = eRow[2] * detInverse;
+                            flags = findPixelVisibility(gbuf, buf, tri, swapped ? q : p, 
+                                swapped ? p : q, vary[2], x, y);
+                        } else {
+                            flags = findPixelColor(sha, frame, gbuf, buf, unif, tex, vary, 
+                                lodGrads, x, y);
+                        }
+                        shadedNum += (flags & triSHADED);
+                        passedNum += (flags & triPASSED) >> 1;
+                    } else if (covered) {
+                        break;
+                    }
+                    for (int k = 0; k < 3; k++) {
+                        eRow[k] += edges[k].a;
+                    }
                 }
             }
         }
-        /* Triangle has no vertical lines, so it must be rendered in halves */
-        else {
-            for (int x = max(0, ceil(a[0])); x <= min(buf->width, floor(b[0])); x++) {
-                for (int y = getYLoopStart(a, b, x); y <= getYLoopEnd(buf-> height, a, c, x); y++) {
-                        findPixelColor(sha, buf, unif, tex, a, b, c, mInverse, x, y);
+    }
+    counters->coveredNum += coveredNum;
+    counters->earlyRejectNum += coveredNum - shadedNum;
+    counters->shadedNum += shadedNum;
+    counters->passedNum += passedNum;
+}
+
+/* Snapped vertices have at most triSUBPIXELBITSMAX fractional bits, and must 
+lie less than triFIXEDLIMIT grid units from the origin, so that the fixed-point 
+edge functions cannot overflow a long long. */
+#define triSUBPIXELBITSMAX 16
+#define triFIXEDLIMIT (1LL << 28)
+
+/* Like triEdge, but in fixed point, with coordinates in units of 1 / 2^bits 
+pixels. The values are exact, so the endpoints need no ordering, and pixels are 
+inside when E > threshold. */
+typedef struct triFixedEdge triFixedEdge;
+struct triFixedEdge {
+    long long x0, y0, a, b;
+    long long threshold;
+};
+
+/* Sets up the fixed-point edge function for the directed edge from v to w, for 
+a triangle that is counterclockwise. */
+void triFixedEdgeSetup(const long long v[], const long long w[], triFixedEdge *edge) {
+    long long dx = w[0] - v[0], dy = w[1] - v[1];
+    edge->x0 = v[0];
+    edge->y0 = v[1];
+    edge->a = -dy;
+    edge->b = dx;
+    edge->threshold = ((dy < 0 || (dy == 0 && dx < 0)) ? -1 : 0);
+}
+
+/* Evaluates the fixed-point edge function at pixel (x, y). unit is 2^bits. */
+long long triFixedEdgeEvaluate(const triFixedEdge *edge, int x, int y, long long unit) {
+    return edge->a * (x * unit - edge->x0) + edge->b * (y * unit - edge->y0);
+}
+
+/* Returns the fixed-point value v, with unit = 2^bits, rounded down to a whole 
+pixel. */
+long long triFixedFloor(long long v, long long unit) {
+    return (v >= 0 ? v : v - (unit - 1)) / unit;
+}
+
+/* Like triRenderScissor, but first snaps the vertices' x and y to a grid of 
+1 / 2^bits pixels, where 0 <= bits <= triSUBPIXELBITSMAX. Coverage is then 
+computed exactly, in integers, so it does not depend on the precision or 
+order of any floating-point arithmetic. The varyings are still interpolated in 
+double precision, with weights from the snapped vertices. Triangles too large 
+for the grid fall back to triRenderScissor. */
+void triRenderFixed(
+        const shaShading *sha, frameBuffer *frame, gbufBuffer *gbuf, depthBuffer *buf, 
+        const double unif[], const texTexture *tex[], const double a[], const double b[], 
+        const double c[], int tri, int bits, const int scissor[4], triCounters *counters) {
+    int visible = (gbuf != NULL && gbuf->format == gbufVISIBILITY);
+    int varyDim = (visible ? 3 : sha->varyDim), swapped = 0;
+    bits = min(max(bits, 0), triSUBPIXELBITSMAX);
+    long long unit = 1LL << bits;
+
+    // Snap the vertices to the grid
+    const double *verts[3] = {a, b, c};
+    long long snapped[3][2];
+    for (int k = 0; k < 3; k++) {
+        for (int j = 0; j < 2; j++) {
+            double v = verts[k][j] * unit;
+            if (!(fabs(v) < triFIXEDLIMIT)) {
+                triRenderScissor(sha, frame, gbuf, buf, unif, tex, a, b, c, tri, scissor, counters);
+                return;
+            }
+            snapped[k][j] = llround(v);
+        }
+    }
+    const long long *sa = snapped[0], *sb = snapped[1], *sc = snapped[2];
+
+    // Reorder clockwise triangles, and drop degenerate ones
+    long long det = (sb[0] - sa[0]) * (sc[1] - sa[1]) - (sc[0] - sa[0]) * (sb[1] - sa[1]);
+    if (det < 0) {
+        const double *swap = b;
+        b = c;
+        c = swap;
+        const long long *snappedSwap = sb;
+        sb = sc;
+        sc = snappedSwap;
+        det = -det;
+        swapped = 1;
+    }
+    if (det == 0) {
+        return;
+    }
+
+    // Bounding box of the snapped triangle, clipped to the scissor rectangle
+    long long xLow = sa[0], xHigh = sa[0], yLow = sa[1], yHigh = sa[1];
+    xLow = (sb[0] < xLow ? sb[0] : xLow);
+    xLow = (sc[0] < xLow ? sc[0] : xLow);
+    xHigh = (sb[0] > xHigh ? sb[0] : xHigh);
+    xHigh = (sc[0] > xHigh ? sc[0] : xHigh);
+    yLow = (sb[1] < yLow ? sb[1] : yLow);
+    yLow = (sc[1] < yLow ? sc[1] : yLow);
+    yHigh = (sb[1] > yHigh ? sb[1] : yHigh);
+    yHigh = (sc[1] > yHigh ? sc[1] : yHigh);
+    int xMin = max(scissor[0], (int)-triFixedFloor(-xLow, unit));
+    int xMax = min(scissor[1], (int)triFixedFloor(xHigh, unit));
+    int yMin = max(scissor[2], (int)-triFixedFloor(-yLow, unit));
+    int yMax = min(scissor[3], (int)triFixedFloor(yHigh, unit));
+    if (xMin > xMax || yMin > yMax) {
+        return;
+    }
+
+    /* As in triRenderScissor, edge k is opposite vertex k. stepX and stepY are 
+    the changes in the edge functions from one pixel to the next. */
+    triFixedEdge edges[3];
+    triFixedEdgeSetup(sb, sc, &edges[0]);
+    triFixedEdgeSetup(sc, sa, &edges[1]);
+    triFixedEdgeSetup(sa, sb, &edges[2]);
+    long long stepX[3], stepY[3], reach[3];
+    for (int k = 0; k < 3; k++) {
+        stepX[k] = edges[k].a * unit;
+        stepY[k] = edges[k].b * unit;
+        reach[k] = ((stepX[k] > 0 ? stepX[k] : 0) + (stepY[k] > 0 ? stepY[k] : 0)) * 
+            (triBLOCKSIZE - 1);
+    }
+
+    double detInverse = 1.0 / (double)det;
+    double bMinusA[varyDim], cMinusA[varyDim], dVarydX[varyDim];
+    vecSubtract(varyDim, b, a, bMinusA);
+    vecSubtract(varyDim, c, a, cMinusA);
+    for (int i = 0; i < varyDim; i++) {
+        dVarydX[i] = ((double)stepX[1] * bMinusA[i] + (double)stepX[2] * cMinusA[i]) * detInverse;
+    }
+
+    // Coarse depth rejection, as in triRenderScissor
+    int hierarchical = (sha->depthMode == shaEARLYDEPTH || gbuf != NULL);
+    double zNear = a[2], dZdX = 0.0, dZdY = 0.0, zMargin = 0.0;
+    if (hierarchical) {
+        zNear = (b[2] < zNear ? b[2] : zNear);
+        zNear = (c[2] < zNear ? c[2] : zNear);
+        zMargin = 1.0e-9 * (1.0 + fabs(zNear));
+        if (triIsHidden(buf, zNear - zMargin, xMin, xMax, yMin, yMax)) {
+            counters->hiddenTriangleNum += 1;
+            return;
+        }
+        dZdX = dVarydX[2];
+        dZdY = ((double)stepY[1] * bMinusA[2] + (double)stepY[2] * cMinusA[2]) * detInverse;
+        dZdX = (dZdX < 0.0 ? dZdX : 0.0) * (triBLOCKSIZE - 1);
+        dZdY = (dZdY < 0.0 ? dZdY : 0.0) * (triBLOCKSIZE - 1);
+    }
+
+    // Mipmap levels, as in triRenderScissor
+    int texNum = (sha->texNum > 0 ? sha->texNum : 1);
+    texTexture views[texNum];
+    const texTexture *viewPtrs[texNum];
+    double grads[4];
+    const double *lodGrads = NULL;
+    if (!visible && sha->texCoordIndex >= 4 && sha->texNum > 0) {
+        triGetGradient(a, b, c, sha->texCoordIndex, &grads[0]);
+        triGetGradient(a, b, c, sha->texCoordIndex + 1, &grads[2]);
+        triSetLODs(sha->texNum, tex, &grads[0], &grads[2], views, viewPtrs);
+        tex = viewPtrs;
+        lodGrads = grads;
+    }
+
+    double vary[varyDim];
+    long long e[3], eRow[3];
+    long coveredNum = 0, shadedNum = 0, passedNum = 0;
+    int xBlockMin = xMin - xMin % triBLOCKSIZE, yBlockMin = yMin - yMin % triBLOCKSIZE;
+    for (int yBlock = yBlockMin; yBlock <= yMax; yBlock += triBLOCKSIZE) {
+        for (int xBlock = xBlockMin; xBlock <= xMax; xBlock += triBLOCKSIZE) {
+            /* The edge functions are exact, so a block is empty exactly when 
+            some edge function is at most its threshold all over it. */
+            int empty = 0;
+            for (int k = 0; k < 3; k++) {
+                e[k] = triFixedEdgeEvaluate(&edges[k], xBlock, yBlock, unit);
+                if (e[k] + reach[k] <= edges[k].threshold) {
+                    empty = 1;
+                }
+            }
+            if (empty) {
+                continue;
+            }
+            if (hierarchical) {
+                double zBlock = a[2] + (double)e[1] * detInverse * bMinusA[2] + 
+                    (double)e[2] * detInverse * cMinusA[2] + dZdX + dZdY;
+                zBlock = (zBlock > zNear ? zBlock : zNear) - zMargin;
+                if (zBlock >= depthGetFarthest(buf, 0, xBlock >> depthLEVELSHIFT, 
+                        yBlock >> depthLEVELSHIFT)) {
+                    counters->hiddenBlockNum += 1;
+                    continue;
                 }
             }
-            for (int x = max(0, floor(b[0])) + 1; x <= min(buf->width, floor(c[0])); x++) {
-                for (int y = getYLoopStart(c, b, x); y <= getYLoopEnd(buf-> height, a, c, x); y++) {
-                        findPixelColor(sha, buf, unif, tex, a, b, c, mInverse, x, y);
+            int xStart = max(xBlock, xMin), xEnd = min(xBlock + triBLOCKSIZE - 1, xMax);
+            int yStart = max(yBlock, yMin), yEnd = min(yBlock + triBLOCKSIZE - 1, yMax);
+            for (int y = yStart; y <= yEnd; y++) {
+                for (int k = 0; k < 3; k++) {
+                    eRow[k] = e[k] + (y - yBlock) * stepY[k] + (xStart - xBlock) * stepX[k];
+                }
+                int covered = 0;
+                for (int x = xStart; x <= xEnd; x++) {
+                    if (eRow[0] > edges[0].threshold && eRow[1] > edges[1].threshold && 
+                            eRow[2] > edges[2].threshold) {
+                        if (!covered) {
+                            double p = (double)eRow[1] * detInverse;
+                            double q = (double)eRow[2] * detInverse;
+                            for (int i = 0; i < varyDim; i++) {
+                                vary[i] = a[i] + p * bMinusA[i] + q * cMinusA[i];
+                            }
+                            covered = 1;
+                        } else {
+                            vecAdd(varyDim, vary, dVarydX, vary);
+                        }
+                        coveredNum += 1;
+                        int flags;
+                        if (visible) {
+                            double p = (double)eRow[1] * detInverse;
+                            double q = (double)eRow[2] * detInverse;
+                            flags = findPixelVisibility(gbuf, buf, tri, swapped ? q : p, 
+                                swapped ? p : q, vary[2], x, y);
+                        } else {
+                            flags = findPixelColor(sha, frame, gbuf, buf, unif, tex, vary, 
+                                lodGrads, x, y);
+                        }
+                        shadedNum += (flags & triSHADED);
+                        passedNum += (flags & triPASSED) >> 1;
+                    } else if (covered) {
+                        break;
+                    }
+                    for (int k = 0; k < 3; k++) {
+                        eRow[k] += stepX[k];
+                    }
                 }
             }
-        } 
+        }
     }
+    counters->coveredNum += coveredNum;
+    counters->earlyRejectNum += coveredNum - shadedNum;
+    counters->shadedNum += shadedNum;
+    counters->passedNum += passedNum;
 }
 
 /* Assumes that the 0th and 1th elements of a, b, c are the 'x' and 'y' 
 coordinates of the vertices, respectively (used in rasterization, and to 
-interpolate the other elements of a, b, c). */
+interpolate the other elements of a, b, c). Adds what happened to the covered 
+pixels to counters. If gbuf is not NULL, the shading is deferred, as described 
+at findPixelColor. If gbuf is a visibility buffer, then it records the triangle 
+as number tri, with the weights of b and c; otherwise tri is ignored. */
 void triRender(
-        const shaShading *sha, depthBuffer *buf, const double unif[], const texTexture *tex[], 
-        const double a[], const double b[], const double c[]) {
-
-    /* reorganize point labeling and associated colors so that the triangle has point A on the left */
-    if (a[0] <= b[0] && a[0] <= c[0]) {
-        triRenderALeft(sha, buf, unif, tex, a, b, c);
-    }
-    else if (b[0] <= a[0] && b[0] <= c[0]) {
-        triRenderALeft(sha, buf, unif, tex, b, c, a);
-    }
-    else if (c[0] <= a[0] && c[0] <= b[0]) {
-        triRenderALeft(sha, buf, unif, tex, c, a, b);
-    }
+        const shaShading *sha, frameBuffer *frame, gbufBuffer *gbuf, depthBuffer *buf, 
+        const double unif[], const texTexture *tex[], const double a[], const double b[], 
+        const double c[], int tri, triCounters *counters) {
+    int scissor[4] = {0, buf->width - 1, 0, buf->height - 1};
+    triRenderScissor(sha, frame, gbuf, buf, unif, tex, a, b, c, tri, scissor, counters);
 }
-
@@ -168,6 +168,26 @@ void camGetProjectionInverseIsometry(const camCamera *cam, double homog[4][4]) {
 }
 
 
+/* Computes the six planes bounding the camera's viewing volume, in world 
+coordinates: left, right, bottom, top, near, far. A point x is inside the 
+volume when planes[i][0] x[0] + planes[i][1] x[1] + planes[i][2] x[2] + 
+planes[i][3] >= 0 for every i. Each plane's normal (its first three entries) 
+is a unit vector, so that plane is a signed distance. */
+void camGetFrustumPlanes(const camCamera *cam, double planes[6][4]) {
+	double homog[4][4], length;
+	camGetProjectionInverseIsometry(cam, homog);
+	/* In clip coordinates the volume is -w <= x, y, z <= w. */
+	for (int i = 0; i < 3; i += 1) {
+		vecAdd(4, homog[3], homog[i], planes[2 * i]);
+		vecSubtract(4, homog[3], homog[i], planes[2 * i + 1]);
+	}
+	for (int i = 0; i < 6; i += 1) {
+		length = vecLength(3, planes[i]);
+		vecScale(4, 1.0 / length, planes[i], planes[i]);
+	}
+}
+
+
 
 /*** Convenience functions for isometry ***/
 
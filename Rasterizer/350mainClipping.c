@@ -1,16 +1,30 @@
 // Nathaniel Li
 
-/* On macOS, compile with...
-    clang 350mainClipping.c 040pixel.o -lglfw -framework OpenGL -framework Cocoa -framework IOKit
+/* The files shared with the raytracer, 040pixel.h, 040frame.c, 
+040pixelHeadless.c, and 250mesh3D.c, live in ../Raytracer, so every build needs 
+-I../Raytracer. On macOS, compile with...
+    clang -I../Raytracer 350mainClipping.c 040pixel.o -lglfw -framework OpenGL -framework Cocoa -framework IOKit
 On Ubuntu, compile with...
-    cc 340mainLandscape.c 040pixel.o -lglfw -lGL -lm -ldl
+    cc -I../Raytracer 350mainClipping.c 040pixel.o -lglfw -lGL -lm -ldl -lpthread
+Without a display, compile with 040pixelHeadless.c in place of 040pixel.o and 
+the graphics libraries, and see that file for how to run it...
+    cc -I../Raytracer 350mainClipping.c ../Raytracer/040pixelHeadless.c -lm -lpthread
+Run with an optional thread count, for example
+    ./a.out 8
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#ifdef __has_include
+#if __has_include(<GLFW/glfw3.h>)
 #include <GLFW/glfw3.h>
+#endif
+#else
+#include <GLFW/glfw3.h>
+#endif
 #include <time.h>
+#include <pthread.h>
 
 #include "040pixel.h"
 
@@ -18,8 +32,12 @@ On Ubuntu, compile with...
 #include "280matrix.c"
 #include "150texture.c"
 #include "260shading.c"
+#include "040frame.c"
 #include "260depth.c"
+#include "360gbuffer.c"
 #include "270triangle.c"
+#include "360pool.c"
+#include "360renderer.c"
 #include "350mesh.c"
 #include "190mesh2D.c"
 #include "250mesh3D.c"
@@ -46,7 +64,6 @@ On Ubuntu, compile with...
 #define VARYN 6
 #define VARYO 7
 #define VARYP 8
-#define VARYPERSPECTIVECORRECTION 9
 #define UNIFMODELING 0
 #define UNIFPROJINVISOM 16
 #define TEXR 0
@@ -62,17 +79,36 @@ void shadeVertex(
 	mat441Multiply((double(*)[4])(&unif[UNIFMODELING]), attrHomog, modHomog);
 	mat441Multiply((double(*)[4])(&unif[UNIFPROJINVISOM]), modHomog, vary);
 	vecCopy(5, &attr[ATTRS], &vary[VARYS]);
-	vary[VARYPERSPECTIVECORRECTION] = 1;
+}
+
+/* Does the same as shadeVertex, for vertNum vertices at once. Working across
+the streams lets the compiler transform several vertices per instruction. But
+this shader is so cheap that rearranging the mesh's vertices into streams costs
+more than it saves, so it is off by default; press V to try it. */
+void shadeVertices(
+        int vertNum, int unifDim, const double unif[], int attrDim,
+        const double *attrs[], int varyDim, double *varys[]) {
+	const double *mod = &unif[UNIFMODELING], *proj = &unif[UNIFPROJINVISOM];
+	const double *x = attrs[ATTRX], *y = attrs[ATTRY], *z = attrs[ATTRZ];
+	double *outX = varys[VARYX], *outY = varys[VARYY], *outZ = varys[VARYZ];
+	double *outW = varys[VARYW];
+	for (int v = 0; v < vertNum; v += 1) {
+		double modX = mod[0] * x[v] + mod[1] * y[v] + mod[2] * z[v] + mod[3];
+		double modY = mod[4] * x[v] + mod[5] * y[v] + mod[6] * z[v] + mod[7];
+		double modZ = mod[8] * x[v] + mod[9] * y[v] + mod[10] * z[v] + mod[11];
+		double modW = mod[12] * x[v] + mod[13] * y[v] + mod[14] * z[v] + mod[15];
+		outX[v] = proj[0] * modX + proj[1] * modY + proj[2] * modZ + proj[3] * modW;
+		outY[v] = proj[4] * modX + proj[5] * modY + proj[6] * modZ + proj[7] * modW;
+		outZ[v] = proj[8] * modX + proj[9] * modY + proj[10] * modZ + proj[11] * modW;
+		outW[v] = proj[12] * modX + proj[13] * modY + proj[14] * modZ + proj[15] * modW;
+	}
+	for (int k = 0; k < 5; k += 1)
+		vecCopy(vertNum, attrs[ATTRS + k], varys[VARYS + k]);
 }
 
 void shadeFragment(
         int unifDim, const double unif[], int texNum, const texTexture *tex[], 
         int varyDim, const double vary[], double rgbd[4]) {
-	double correctedVary[varyDim];
-    vecCopy(4, vary, correctedVary);
-    for (int i = VARYS; i < varyDim; i++) {
-        correctedVary[i] = vary[i] / vary[VARYPERSPECTIVECORRECTION];
-    }
 	double sample[tex[0]->texelDim];
 	texSample(tex[0], vary[VARYS], vary[VARYT], sample);
 	sample[0] = sample[1] * 0.2 + 0.8;
@@ -83,6 +119,29 @@ void shadeFragment(
 	rgbd[3] = vary[VARYZ];
 }
 
+/* Does the same as shadeFragment, for fragNum fragments at once, sampling the 
+texture for all of them with one texSampleN. Deferred shading uses it, when the 
+texture isn't trilinear; press B to try it, and G to defer. */
+void shadeFragments(
+        int fragNum, int unifDim, const double unif[], int texNum, 
+        const texTexture *tex[], int varyDim, const double *varys[], 
+        double *rgbds[]) {
+	int texelDim = tex[0]->texelDim;
+	double samples[fragNum * texelDim];
+	texSampleN(tex[0], fragNum, varys[VARYS], varys[VARYT], samples);
+	const double *n = varys[VARYN], *o = varys[VARYO], *p = varys[VARYP];
+	for (int f = 0; f < fragNum; f += 1) {
+		double green = samples[f * texelDim + 1];
+		double intensity = p[f] / sqrt(n[f] * n[f] + o[f] * o[f] + p[f] * p[f]);
+		rgbds[0][f] = intensity * (green * 0.2 + 0.8);
+		rgbds[1][f] = intensity * (green * 0.2 + 0.6);
+		rgbds[2][f] = intensity * 0.3;
+		rgbds[3][f] = varys[VARYZ][f];
+	}
+}
+
+renRenderer ren;
+frameBuffer frame;
 depthBuffer buf;
 shaShading sha;
 texTexture texture;
@@ -103,22 +162,59 @@ camCamera cam;
 double angle = M_PI * 0;//.25;
 
 void render(void) {
-	pixClearRGB(0.8, 0.8, 1.0);
+	renClearStatistics(&ren);
+	frameClearRGB(&frame, 0.8, 0.8, 1.0);
 	depthClearDepths(&buf, 1000000000.0);
-	double projInvIsom[4][4];
+	double projInvIsom[4][4], planes[6][4];
 	camGetProjectionInverseIsometry(&cam, projInvIsom);
     vecCopy(16, (double *)projInvIsom, &unif[UNIFPROJINVISOM]);
-	meshRender(&landMesh, &buf, viewport, &sha, unif, tex);
+	/* The modeling transformation is the identity, so the frustum's world 
+	coordinates are also the mesh's coordinates. */
+	camGetFrustumPlanes(&cam, planes);
+	if (!meshIsOutside(&landMesh, planes, 6))
+		meshRender(&landMesh, &ren, &frame, &buf, viewport, &sha, unif, tex);
+	framePresent(&frame);
 }
 
 void handleKeyUp(
         int key, int shiftIsDown, int controlIsDown, int altOptionIsDown, 
         int superCommandIsDown) {
 	if (key == GLFW_KEY_ENTER) {
-		if (texture.filtering == texLINEAR)
+		if (texture.filtering == texNEAREST)
+			texSetFiltering(&texture, texLINEAR);
+		else if (texture.filtering == texLINEAR)
+			texSetFiltering(&texture, texTRILINEAR);
+		else
 			texSetFiltering(&texture, texNEAREST);
+	} else if (key == GLFW_KEY_Z) {
+		if (sha.depthMode == shaEARLYDEPTH)
+			sha.depthMode = shaLATEDEPTH;
 		else
-			texSetFiltering(&texture, texLINEAR);
+			sha.depthMode = shaEARLYDEPTH;
+	} else if (key == GLFW_KEY_C) {
+		if (sha.cullMode == shaCULLBACK)
+			sha.cullMode = shaCULLNONE;
+		else
+			sha.cullMode = shaCULLBACK;
+	} else if (key == GLFW_KEY_F) {
+		if (ren.subpixelBits == 0)
+			renSetSubpixelBits(&ren, 8);
+		else
+			renSetSubpixelBits(&ren, 0);
+	} else if (key == GLFW_KEY_T) {
+		renSetTiming(&ren, !ren.timing);
+	} else if (key == GLFW_KEY_G) {
+		renSetDeferred(&ren, (ren.deferred + 1) % 3);
+	} else if (key == GLFW_KEY_V) {
+		if (sha.shadeVertices == NULL)
+			sha.shadeVertices = shadeVertices;
+		else
+			sha.shadeVertices = NULL;
+	} else if (key == GLFW_KEY_B) {
+		if (sha.shadeFragments == NULL)
+			sha.shadeFragments = shadeFragments;
+		else
+			sha.shadeFragments = NULL;
 	} else if (key == GLFW_KEY_P) {
 	    if (cam.projectionType == camORTHOGRAPHIC)
 		    camSetProjectionType(&cam, camPERSPECTIVE);
@@ -151,12 +247,30 @@ void handleKeyDownAndRepeat(
 }
 
 void handleTimeStep(double oldTime, double newTime) {
-	if (floor(newTime) - floor(oldTime) >= 1.0)
-		printf("handleTimeStep: %f frames/sec\n", 1.0 / (newTime - oldTime));
 	render();
+	if (floor(newTime) - floor(oldTime) >= 1.0) {
+		printf("handleTimeStep: %f frames/sec\n", 1.0 / (newTime - oldTime));
+		printf("handleTimeStep: %ld of %ld triangles culled, %ld rejected, "
+			"%ld and %ld clipped into one and more, %ld rasterized\n", 
+			ren.stats.culledNum, ren.stats.triangleNum, ren.stats.rejectedNum, 
+			ren.stats.clippedOneNum, ren.stats.clippedTwoNum, 
+			ren.stats.rasterizedNum);
+		printf("handleTimeStep: %ld of %ld fragment shader invocations avoided "
+			"by early depth, %f overdraw\n", ren.stats.counters.earlyRejectNum, 
+			ren.stats.counters.coveredNum, renGetOverdraw(&ren, &buf));
+		printf("handleTimeStep: %ld triangles and %ld blocks hidden by the "
+			"coarse depth levels\n", ren.stats.counters.hiddenTriangleNum, 
+			ren.stats.counters.hiddenBlockNum);
+		printf("handleTimeStep: %f ms shading vertices, %f ms on primitives, "
+			"%f ms rasterizing\n", ren.stats.vertexTime * 1000.0, 
+			ren.stats.primitiveTime * 1000.0, ren.stats.rasterTime * 1000.0);
+	}
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
+    int threadNum = 1;
+    if (argc > 1)
+        threadNum = atoi(argv[1]);
     /* Randomly generate a grid of elevation data. */
     double landData[LANDSIZE * LANDSIZE];
     landFlat(LANDSIZE, landData, 0.0);
@@ -172,18 +286,43 @@ int main(void) {
     /* Marshal resources. */
 	if (pixInitialize(512, 512, "Landscape") != 0)
 		return 1;
-	if (depthInitialize(&buf, 512, 512) != 0) {
+	if (renInitialize(&ren, threadNum) != 0) {
+	    pixFinalize();
+		return 6;
+	}
+	if (frameInitialize(&frame, 512, 512, frameRGBA8) != 0) {
+	    renFinalize(&ren);
+	    pixFinalize();
+		return 7;
+	}
+	if (depthInitialize(&buf, 512, 512, depthDOUBLE) != 0) {
+	    frameFinalize(&frame);
+	    renFinalize(&ren);
 	    pixFinalize();
 		return 5;
 	}
 	if (texInitializeFile(&texture, "awesome.png") != 0) {
 	    depthFinalize(&buf);
+	    frameFinalize(&frame);
+	    renFinalize(&ren);
+	    pixFinalize();
+		return 2;
+	}
+	/* t runs up the slopes of the landscape, so texels above and below each 
+	other are sampled together as often as texels side by side. */
+	if (texSetLayout(&texture, texTILES) != 0) {
+	    texFinalize(&texture);
+	    depthFinalize(&buf);
+	    frameFinalize(&frame);
+	    renFinalize(&ren);
 	    pixFinalize();
 		return 2;
 	}
 	if (mesh3DInitializeLandscape(&landMesh, LANDSIZE, 1.0, landData) != 0) {
 	    texFinalize(&texture);
 	    depthFinalize(&buf);
+	    frameFinalize(&frame);
+	    renFinalize(&ren);
 	    pixFinalize();
 		return 3;
 	}
@@ -196,6 +335,7 @@ int main(void) {
 	    attr[ATTRT] = attr[ATTRZ];
 	    meshSetVertex(&landMesh, i, attr);
 	}
+	meshUpdateBounds(&landMesh);
 	/* Configure texture. */
     texSetFiltering(&texture, texNEAREST);
     texSetLeftRight(&texture, texREPEAT);
@@ -205,8 +345,13 @@ int main(void) {
     sha.attrDim = 3 + 2 + 3;
     sha.varyDim = 4 + 2 + 3;
     sha.shadeVertex = shadeVertex;
+    sha.shadeVertices = NULL;
     sha.shadeFragment = shadeFragment;
+    sha.shadeFragments = NULL;
+    sha.depthMode = shaEARLYDEPTH;
+    sha.cullMode = shaCULLBACK;
     sha.texNum = 1;
+    sha.texCoordIndex = VARYS;
     /* Configure viewport and camera. */
     mat44Viewport(512, 512, viewport);
     camSetProjectionType(&cam, camPERSPECTIVE);
@@ -224,6 +369,8 @@ int main(void) {
     meshFinalize(&landMesh);
     texFinalize(&texture);
     depthFinalize(&buf);
+    frameFinalize(&frame);
+    renFinalize(&ren);
     pixFinalize();
     return 0;
 }
@@ -4,18 +4,90 @@
 /*** Creating and destroying ***/
 
 /* Feel free to read the struct's members, but don't write them, except through 
-the accessors below such as meshSetTriangle, meshSetVertex. */
+the accessors below such as meshSetTriangle, meshSetVertex. The mesh caches a 
+bounding sphere (center, radius) and a bounding box (low, high) of its 
+vertices' first three attributes, which are assumed to be XYZ. They are never 
+too small, but they may be too big. A radius below zero means that no vertex 
+has been set yet. */
 typedef struct meshMesh meshMesh;
 struct meshMesh {
 	int triNum, vertNum, attrDim;
 	int *tri;						/* triNum * 3 ints */
 	double *vert;					/* vertNum * attrDim doubles */
+	double center[3], radius;
+	double low[3], high[3];
 };
 
+/* Private. Empties the mesh's bounding sphere and box. */
+void meshClearBounds(meshMesh *mesh) {
+	for (int k = 0; k < 3; k += 1) {
+		mesh->center[k] = 0.0;
+		mesh->low[k] = HUGE_VAL;
+		mesh->high[k] = -HUGE_VAL;
+	}
+	mesh->radius = -1.0;
+}
+
+/* Private. Grows the mesh's bounding sphere and box to contain the point with 
+the given attributes. */
+void meshGrowBounds(meshMesh *mesh, const double attr[]) {
+	double p[3] = {0.0, 0.0, 0.0}, diff[3], dist;
+	vecCopy(mesh->attrDim < 3 ? mesh->attrDim : 3, attr, p);
+	for (int k = 0; k < 3; k += 1) {
+		mesh->low[k] = (p[k] < mesh->low[k] ? p[k] : mesh->low[k]);
+		mesh->high[k] = (p[k] > mesh->high[k] ? p[k] : mesh->high[k]);
+	}
+	if (mesh->radius < 0.0) {
+		vecCopy(3, p, mesh->center);
+		mesh->radius = 0.0;
+		return;
+	}
+	/* Move the sphere toward p, just far enough to reach it. */
+	vecSubtract(3, p, mesh->center, diff);
+	dist = vecLength(3, diff);
+	if (dist > mesh->radius) {
+		vecScale(3, (dist - mesh->radius) / (2.0 * dist), diff, diff);
+		vecAdd(3, mesh->center, diff, mesh->center);
+		mesh->radius = (mesh->radius + dist) / 2.0;
+	}
+}
+
+/* Recomputes the bounding sphere and box from scratch, as tightly as this 
+simple method allows. Call it after changing vertices through 
+meshGetVertexPointer rather than meshSetVertex. */
+void meshUpdateBounds(meshMesh *mesh) {
+	double p[3] = {0.0, 0.0, 0.0}, diff[3], dist;
+	int i, k, dim = (mesh->attrDim < 3 ? mesh->attrDim : 3);
+	meshClearBounds(mesh);
+	if (mesh->vertNum == 0)
+		return;
+	for (i = 0; i < mesh->vertNum; i += 1)
+		for (k = 0; k < dim; k += 1) {
+			p[k] = mesh->vert[mesh->attrDim * i + k];
+			mesh->low[k] = (p[k] < mesh->low[k] ? p[k] : mesh->low[k]);
+			mesh->high[k] = (p[k] > mesh->high[k] ? p[k] : mesh->high[k]);
+		}
+	for (k = dim; k < 3; k += 1) {
+		mesh->low[k] = 0.0;
+		mesh->high[k] = 0.0;
+	}
+	/* The sphere is centered on the box. */
+	vecAdd(3, mesh->low, mesh->high, mesh->center);
+	vecScale(3, 0.5, mesh->center, mesh->center);
+	mesh->radius = 0.0;
+	for (i = 0; i < mesh->vertNum; i += 1) {
+		vecCopy(dim, &mesh->vert[mesh->attrDim * i], p);
+		vecSubtract(3, p, mesh->center, diff);
+		dist = vecLength(3, diff);
+		mesh->radius = (dist > mesh->radius ? dist : mesh->radius);
+	}
+}
+
 /* Initializes a mesh with enough memory to hold its triangles and vertices. 
-Does not actually fill in those triangles or vertices with useful data. When 
-you are finished with the mesh, you must call meshFinalize to deallocate its 
-backing resources. */
+Does not actually fill in those triangles or vertices with useful data, so the 
+bounds start out empty and grow with each meshSetVertex. When you are finished 
+with the mesh, you must call meshFinalize to deallocate its backing 
+resources. */
 int meshInitialize(meshMesh *mesh, int triNum, int vertNum, int attrDim) {
 	mesh->tri = (int *)malloc(triNum * 3 * sizeof(int) +
 		vertNum * attrDim * sizeof(double));
@@ -24,6 +96,7 @@ int meshInitialize(meshMesh *mesh, int triNum, int vertNum, int attrDim) {
 		mesh->triNum = triNum;
 		mesh->vertNum = vertNum;
 		mesh->attrDim = attrDim;
+		meshClearBounds(mesh);
 	}
 	return (mesh->tri == NULL);
 }
@@ -47,12 +120,36 @@ int *meshGetTrianglePointer(const meshMesh *mesh, int tri) {
 		return NULL;
 }
 
-/* Sets the vertth vertex to have attributes attr. */
+/* Sets the vertth vertex to have attributes attr, growing the bounds if 
+necessary. */
 void meshSetVertex(meshMesh *mesh, int vert, const double attr[]) {
 	int k;
-	if (0 <= vert && vert < mesh->vertNum)
+	if (0 <= vert && vert < mesh->vertNum) {
 		for (k = 0; k < mesh->attrDim; k += 1)
 			mesh->vert[mesh->attrDim * vert + k] = attr[k];
+		meshGrowBounds(mesh, attr);
+	}
+}
+
+/* Returns whether the mesh lies entirely outside the volume bounded by the 
+given planes, such as those from camGetFrustumPlanes. The planes must be in 
+the same coordinates as the mesh's XYZ, and their normals must be unit 
+vectors. A mesh whose bounds are empty is never reported as outside, because 
+its vertices may have been written through meshGetVertexPointer. */
+int meshIsOutside(const meshMesh *mesh, const double planes[][4], int planeNum) {
+	double corner[3];
+	if (mesh->radius < 0.0)
+		return 0;
+	for (int i = 0; i < planeNum; i += 1) {
+		if (vecDot(3, planes[i], mesh->center) + planes[i][3] < -mesh->radius)
+			return 1;
+		/* Test the corner of the box farthest along the plane's normal. */
+		for (int k = 0; k < 3; k += 1)
+			corner[k] = (planes[i][k] >= 0.0 ? mesh->high[k] : mesh->low[k]);
+		if (vecDot(3, planes[i], corner) + planes[i][3] < 0.0)
+			return 1;
+	}
+	return 0;
 }
 
 /* Returns a pointer to the vertth vertex. For example:
@@ -147,6 +244,7 @@ int meshInitializeFile(meshMesh *mesh, const char *path) {
 	}
 	// Future work: Check EOF.
 	fclose(file);
+	meshUpdateBounds(mesh);
 	return 0;
 }
 
@@ -192,105 +290,223 @@ int meshSaveFile(const meshMesh *mesh, const char *path) {
 
 /*** Rendering ***/
 
-// Get the intersection between a side of a triangle and the near plane
-void getTriangleNearPlaneIntersect(int varyDim, double v1[], double v2[], double nearPlaneIntersect[]) {
-    double t = (v1[2] + v1[3]) / (v1[2] + v1[3] - v2[2] - v2[3]);
-	double bMinusA[varyDim];
-    vecSubtract(varyDim, v2, v1, bMinusA);
-	vecScale(varyDim, t, bMinusA, bMinusA);
-	vecAdd(varyDim, v1, bMinusA, nearPlaneIntersect);
+/* Clip-space planes. A vertex is inside a frustum plane when -w <= x <= w, 
+-w <= y <= w, or -w <= z <= w, and inside a guard-band plane when 
+-g w <= x <= g w or -g w <= y <= g w, where g is the renderer's guard band. */
+#define meshCLIPNEAR 0
+#define meshCLIPFAR 1
+#define meshCLIPLEFT 2
+#define meshCLIPRIGHT 3
+#define meshCLIPBOTTOM 4
+#define meshCLIPTOP 5
+#define meshCLIPPLANENUM 6
+
+/* Returns the signed distance of a clip-space vertex from a plane, with the 
+sides scaled out by the guard band g. It is negative outside the plane. */
+double clipDistance(int plane, double g, const double v[]) {
+	if (plane == meshCLIPNEAR)
+		return v[3] + v[2];
+	else if (plane == meshCLIPFAR)
+		return v[3] - v[2];
+	else if (plane == meshCLIPLEFT)
+		return g * v[3] + v[0];
+	else if (plane == meshCLIPRIGHT)
+		return g * v[3] - v[0];
+	else if (plane == meshCLIPBOTTOM)
+		return g * v[3] + v[1];
+	else
+		return g * v[3] - v[1];
+}
+
+/* Get the determinant of the X, Y, W rows of three clip-space vertices. It is 
+positive if the triangle is counterclockwise once projected to the screen, even 
+if some of its vertices are behind the camera. */
+double clipWinding(const double a[], const double b[], const double c[]) {
+	return a[0] * (b[1] * c[3] - b[3] * c[1]) -
+		a[1] * (b[0] * c[3] - b[3] * c[0]) +
+		a[3] * (b[0] * c[1] - b[1] * c[0]);
+}
+
+/* Returns a bit for each plane that the vertex is outside of, with the sides 
+scaled out by the guard band g. */
+int clipOutcode(double g, const double v[]) {
+	int code = 0;
+	for (int plane = 0; plane < meshCLIPPLANENUM; plane++) {
+		if (clipDistance(plane, g, v) < 0.0) {
+			code |= 1 << plane;
+		}
+	}
+	return code;
 }
 
-// Perform viewport transformation on a vertice
-void viewportTransform(const double viewport[4][4], int varyDim, double v[], double varySS[]) {
+/* Transforms the clip-space vertex v to screen space, into varySS. */
+void viewportTransform(
+        const double viewport[4][4], int varyDim, double v[], double varySS[]) {
 	vecCopy(varyDim, v, varySS);
 	mat441Multiply(viewport, v, varySS);
 	vecScale(varyDim, 1/varySS[3], varySS, varySS);
 }
 
-// Perform viewport transformation on the vertices and render a triangle
-void clipFinal(const meshMesh *mesh, depthBuffer *buf, const double viewport[4][4], 
-		const shaShading *sha, const double unif[], const texTexture *tex[], double v1[], double v2[], double v3[]) {
+/* Transforms the vertices to screen space and renders the triangle. Returns 0 
+on success, or non-zero if the renderer could not render it. */
+int clipFinal(
+        renRenderer *ren, frameBuffer *frame, depthBuffer *buf,
+		const double viewport[4][4], const shaShading *sha, const double unif[],
+		const texTexture *tex[], double v1[], double v2[], double v3[]) {
 	double v1SS[sha->varyDim], v2SS[sha->varyDim], v3SS[sha->varyDim];
 	viewportTransform(viewport, sha->varyDim, v1, v1SS);
 	viewportTransform(viewport, sha->varyDim, v2, v2SS);
 	viewportTransform(viewport, sha->varyDim, v3, v3SS);
-	triRender(sha, buf, unif, tex, v1SS, v2SS, v3SS);
+	return renTriangle(ren, sha, frame, buf, unif, tex, v1SS, v2SS, v3SS);
 }
 
-// Create and call clipFinal on triangles for clipping one vertex
-void clipOneVertex(const meshMesh *mesh, depthBuffer *buf, const double viewport[4][4], 
-		const shaShading *sha, const double unif[], const texTexture *tex[], double v1[], double v2[], double v3[]) {
-	double x1[sha->varyDim], x2[sha->varyDim];
-	getTriangleNearPlaneIntersect(sha->varyDim, v2, v3, x1);
-	getTriangleNearPlaneIntersect(sha->varyDim, v1, v3, x2);
-	clipFinal(mesh, buf, viewport, sha, unif, tex, v1, v2, x1);
-	clipFinal(mesh, buf, viewport, sha, unif, tex, v1, x1, x2);
+/* Clips the triangle against every plane whose bit is set in planes, using the 
+renderer's guard band for the sides, and renders what is left as a fan of 
+triangles. Each plane can add at most one vertex to the polygon, and the 
+polygon keeps the triangle's winding. Returns the number of triangles rendered, 
+which is 0 if the triangle was clipped away entirely, or -1 if the renderer 
+failed to render one of them. */
+int clipPolygon(
+        renRenderer *ren, frameBuffer *frame, depthBuffer *buf,
+		const double viewport[4][4], const shaShading *sha, const double unif[],
+		const texTexture *tex[], const double a[], const double b[],
+		const double c[], int planes) {
+	int varyDim = sha->varyDim, num = 3, newNum;
+	double polys[2][3 + meshCLIPPLANENUM][varyDim], dists[3 + meshCLIPPLANENUM];
+	double (*poly)[varyDim] = polys[0], (*newPoly)[varyDim] = polys[1];
+	double (*swap)[varyDim];
+	vecCopy(varyDim, a, poly[0]);
+	vecCopy(varyDim, b, poly[1]);
+	vecCopy(varyDim, c, poly[2]);
+	for (int plane = 0; plane < meshCLIPPLANENUM && num >= 3; plane++) {
+		if (!(planes & (1 << plane))) {
+			continue;
+		}
+		/* Sutherland-Hodgman: keep the inside vertices, and add a vertex where 
+		an edge crosses the plane, always interpolating from the inside end. */
+		for (int i = 0; i < num; i++) {
+			dists[i] = clipDistance(plane, ren->guardBand, poly[i]);
+		}
+		newNum = 0;
+		for (int i = 0; i < num; i++) {
+			int j = (i + 1) % num;
+			if (dists[i] >= 0.0) {
+				vecCopy(varyDim, poly[i], newPoly[newNum++]);
+			}
+			if ((dists[i] >= 0.0) != (dists[j] >= 0.0)) {
+				int in = (dists[i] >= 0.0 ? i : j), out = (in == i ? j : i);
+				double t = dists[in] / (dists[in] - dists[out]);
+				for (int k = 0; k < varyDim; k++) {
+					newPoly[newNum][k] =
+						poly[in][k] + t * (poly[out][k] - poly[in][k]);
+				}
+				newNum++;
+			}
+		}
+		swap = poly;
+		poly = newPoly;
+		newPoly = swap;
+		num = newNum;
+	}
+	int error = 0;
+	for (int i = 1; i + 1 < num; i++) {
+		error |= clipFinal(ren, frame, buf, viewport, sha, unif, tex, poly[0],
+			poly[i], poly[i + 1]);
+	}
+	if (error) {
+		return -1;
+	}
+	return (num >= 3 ? num - 2 : 0);
 }
 
-// Create and call clipFinal on triangles for clipping two vertices
-void clipTwoVertex(const meshMesh *mesh, depthBuffer *buf, const double viewport[4][4], 
-		const shaShading *sha, const double unif[], const texTexture *tex[], double v1[], double v2[], double v3[]) {
-	double x1[sha->varyDim], x2[sha->varyDim];
-	getTriangleNearPlaneIntersect(sha->varyDim, v1, v2, x1);
-	getTriangleNearPlaneIntersect(sha->varyDim, v1, v3, x2);
-	clipFinal(mesh, buf, viewport, sha, unif, tex, v1, x1, x2);
-}
+/* Renders the mesh into the frame and depth buffers, using the renderer's 
+threads to rasterize and its buffer for the shaded vertices. If the mesh and 
+the shading have differing values for attrDim, or the vertices do not fit in 
+memory, then does not render anything. Adds what each stage did to the 
+renderer's statistics. Returns 0 on success, or non-zero if anything was not 
+rendered. */
+int meshRender(
+        const meshMesh *mesh, renRenderer *ren, frameBuffer *frame,
+		depthBuffer *buf, const double viewport[4][4], const shaShading *sha,
+		const double unif[], const texTexture *tex[]) {
+	/* Check mesh and shading attrDim values. */
+	if (sha->attrDim != mesh->attrDim) {
+		fprintf(stderr, "error: meshRender: attrDim mismatch\n");
+		return 1;
+	} else {
 
-/* Renders the mesh. If the mesh and the shading have differing values for 
-attrDim, then prints an error message and does not render anything. */
-void meshRender(
-        const meshMesh *mesh, depthBuffer *buf, const double viewport[4][4], 
-		const shaShading *sha, const double unif[], const texTexture *tex[]) {
-	// Check mesh and shading attrDim values
-	if (sha->attrDim == mesh->attrDim) {
-
-		// translate, project, viewport transform, and scale each vertice and store it in an 2D array
-		double vary[mesh->vertNum][sha->varyDim];
-		for (int i = 0; i < mesh->vertNum; i++) {
-			sha->shadeVertex(sha->unifDim, unif, sha->attrDim, meshGetVertexPointer(mesh, i), sha->varyDim, vary[i]);
+		/* Translate and project each vertex, into the renderer's buffer. */
+		double *vary = renShadeVertices(ren, sha, unif, mesh->vertNum,
+			mesh->vert);
+		if (vary == NULL) {
+			return 2;
 		}
+		int error = 0;
 
-		// Loop over each triangle
+		/* Loop over each triangle, timing everything but the rasterizer. */
+		renStatistics *stats = &ren->stats;
+		double start = renGetTime(), rasterTime = stats->rasterTime;
+		stats->triangleNum += mesh->triNum;
+		renBegin(ren, buf, sha);
 		for (int i = 0; i < mesh->triNum; i++) {
-			// Get the vertices of the triangle and put into length 3 int array
-			int *verticeIndices = meshGetTrianglePointer(mesh, i);	
-
-            double *a = vary[verticeIndices[0]];
-			double *b = vary[verticeIndices[1]];
-			double *c = vary[verticeIndices[2]];
- 
-           	if (a[3] <= 0 || a[3] < - a[2]) { // Check A
-                if (b[3] <= 0 || b[3] < - b[2]) { // Check B
-                    // A and B are clipped
-                    if (c[3] <= 0 || c[3] < - c[2]) {//(c[3] > 0 || c[3] >= - c[2]) { // If C is NOT clipped
-						
-                    } else {
-						clipTwoVertex(mesh, buf, viewport, sha, unif, tex, c, a, b);
-					}
-                // A and C are clipped
-                } else if (c[3] <= 0 || c[3] < - c[2]) { // Check C
-					clipTwoVertex(mesh, buf, viewport, sha, unif, tex, b, c, a);
-                // A is clipped
-                } else {
-					clipOneVertex(mesh, buf, viewport, sha, unif, tex, b, c, a);
-                }
-            } else if (b[3] <= 0 || b[3] < - b[2]) { // Check B
-                // B and C are clipped
-                if (c[3] <= 0 || c[3] < - c[2]) { // Check C
-					clipTwoVertex(mesh, buf, viewport, sha, unif, tex, a, b, c);
-                // B is clipped
-                } else {
-					clipOneVertex(mesh, buf, viewport, sha, unif, tex, c, a, b);
-                }
-            // C is clipped
-            } else if (c[3] <= 0 || c[3] < - c[2]) { // Check C
-				clipOneVertex(mesh, buf, viewport, sha, unif, tex, a, b, c);
-            // Not A or B or C are clipped
-            } else {
-				clipFinal(mesh, buf, viewport, sha, unif, tex, a, b, c);
-            }
+			/* Get the vertices of the triangle, as a length 3 int array. */
+			int *verticeIndices = meshGetTrianglePointer(mesh, i);
+			double *a = &vary[(long)verticeIndices[0] * sha->varyDim];
+			double *b = &vary[(long)verticeIndices[1] * sha->varyDim];
+			double *c = &vary[(long)verticeIndices[2] * sha->varyDim];
+
+			/* Cull the triangle by its winding, before spending any time on 
+			clipping. */
+			if (sha->cullMode != shaCULLNONE) {
+				double det = clipWinding(a, b, c);
+				int back = !(det > 0.0), front = !(det < 0.0);
+				if (sha->cullMode == shaCULLBACK ? back : front) {
+					stats->culledNum++;
+					continue;
+				}
+			}
+
+			/* Reject the triangle if it is entirely outside one plane of the 
+			frustum. */
+			int codeA = clipOutcode(1.0, a), codeB = clipOutcode(1.0, b);
+			int codeC = clipOutcode(1.0, c);
+			if (codeA & codeB & codeC) {
+				stats->rejectedNum++;
+				continue;
+			}
+
+			/* Clip only against the near and far planes, and the sides of the 
+			guard band that it crosses. Triangles inside the band are 
+			rasterized unclipped, and the rasterizer skips their off-screen 
+			pixels. */
+			int depthMask = (1 << meshCLIPNEAR) | (1 << meshCLIPFAR);
+			int planes = (codeA | codeB | codeC) & depthMask;
+			if ((codeA | codeB | codeC) & ~depthMask) {
+				double g = ren->guardBand;
+				planes |= clipOutcode(g, a) | clipOutcode(g, b) |
+					clipOutcode(g, c);
+			}
+			if (planes == 0) {
+				error |= clipFinal(ren, frame, buf, viewport, sha, unif, tex,
+					a, b, c);
+			} else {
+				int num = clipPolygon(ren, frame, buf, viewport, sha, unif,
+					tex, a, b, c, planes);
+				if (num < 0) {
+					error = 1;
+				} else if (num == 0) {
+					stats->rejectedNum++;
+				} else if (num == 1) {
+					stats->clippedOneNum++;
+				} else {
+					stats->clippedTwoNum++;
+				}
+			}
 		}
+		stats->primitiveTime +=
+			renGetTime() - start - (stats->rasterTime - rasterTime);
+		renEnd(ren, sha, frame, buf, unif, tex);
+		return (error ? 3 : 0);
 	}
 }
 
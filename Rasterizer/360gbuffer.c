@@ -0,0 +1,165 @@
+// Nathaniel Li
+
+
+/*** Creating and destroying ***/
+
+/* The formats of a G-buffer. With gbufVARYINGS, each pixel holds the
+interpolated varyings of the nearest fragment drawn there, and the gradients of
+its texture coordinates, if it has any, for picking mipmap levels just as
+forward shading does. With gbufVISIBILITY, each pixel holds only the index of
+the triangle drawn there and the barycentric weights of its second and third
+vertices, from which the varyings can be interpolated again later; that is 24
+bytes per pixel instead of 8 per varying. The weights are doubles, because
+float weights round large texture coordinates enough to change texels. */
+#define gbufVARYINGS 0
+#define gbufVISIBILITY 1
+
+/* What a visibility buffer stores at each pixel. The varyings there are
+a + p (b - a) + q (c - a), where a, b, c are the varyings of the vertices of
+triangle number tri. */
+typedef struct gbufVisibility gbufVisibility;
+struct gbufVisibility {
+	int tri;
+	double p, q;
+};
+
+/* A G-buffer holds what deferred shading needs to know about the nearest
+fragment drawn at each pixel since the last clear. Deferred shading rasterizes
+into it without running the fragment shader, and then runs the fragment shader
+once for each pixel that was drawn. Clearing is lazy, as in the depth buffer,
+but per pixel: a pixel whose generation is not the buffer's generation has not
+been drawn since the last clear. Feel free to read the struct's members, but
+don't write them, except through the accessors below. */
+typedef struct gbufBuffer gbufBuffer;
+struct gbufBuffer {
+	int width, height, format, varyDim;
+	double *varys;					/* width * height * varyDim doubles */
+	double *grads;					/* and width * height * 4 doubles */
+	gbufVisibility *visibilities;	/* or width * height visibilities */
+	unsigned int generation;
+	unsigned int *generations;		/* width * height generations */
+};
+
+/* Initializes a G-buffer of width x height pixels, in the given format. With
+gbufVARYINGS, each pixel has room for up to varyDim varyings; with
+gbufVISIBILITY, varyDim is ignored. Returns 0 on success, non-zero on failure.
+When you are finished with the buffer, you must call gbufFinalize to deallocate
+its resources. */
+int gbufInitialize(
+        gbufBuffer *gbuf, int width, int height, int format, int varyDim) {
+	long pixelNum = (long)width * height;
+	gbuf->varys = NULL;
+	gbuf->grads = NULL;
+	gbuf->visibilities = NULL;
+	if (format == gbufVISIBILITY) {
+		varyDim = 0;
+		gbuf->visibilities = (gbufVisibility *)malloc(
+			pixelNum * sizeof(gbufVisibility));
+	} else {
+		gbuf->varys = (double *)malloc(pixelNum * varyDim * sizeof(double));
+		gbuf->grads = (double *)malloc(pixelNum * 4 * sizeof(double));
+	}
+	gbuf->generations = (unsigned int *)malloc(pixelNum * sizeof(unsigned int));
+	if ((gbuf->visibilities == NULL && (gbuf->varys == NULL ||
+			gbuf->grads == NULL)) || gbuf->generations == NULL) {
+		fprintf(stderr, "error: gbufInitialize: malloc failed\n");
+		free(gbuf->varys);
+		free(gbuf->grads);
+		free(gbuf->visibilities);
+		free(gbuf->generations);
+		gbuf->varys = NULL;
+		gbuf->grads = NULL;
+		gbuf->visibilities = NULL;
+		gbuf->generations = NULL;
+		return 1;
+	}
+	gbuf->width = width;
+	gbuf->height = height;
+	gbuf->format = format;
+	gbuf->varyDim = varyDim;
+	/* The buffer starts out cleared. */
+	for (long k = 0; k < pixelNum; k += 1)
+		gbuf->generations[k] = 0;
+	gbuf->generation = 1;
+	return 0;
+}
+
+/* Deallocates the resources backing the buffer. */
+void gbufFinalize(gbufBuffer *gbuf) {
+	free(gbuf->varys);
+	free(gbuf->grads);
+	free(gbuf->visibilities);
+	free(gbuf->generations);
+}
+
+
+
+/*** Regular use ***/
+
+/* Marks every pixel as not drawn. Only one number is written here. */
+void gbufClear(gbufBuffer *gbuf) {
+	gbuf->generation += 1;
+	if (gbuf->generation == 0) {
+		/* After four billion clears, the old generations could come back. */
+		for (long k = 0; k < (long)gbuf->width * gbuf->height; k += 1)
+			gbuf->generations[k] = 0;
+		gbuf->generation = 1;
+	}
+}
+
+/* For gbufVARYINGS. Stores the first varyDim varyings, at most the buffer's
+varyDim, of the fragment drawn at pixel (x, y), which must be inside the
+buffer. If grads is not NULL, then it also stores the gradients there of the
+fragment's texture coordinates s and t: dS/dx, dS/dy, dT/dx, dT/dy. Threads
+that own disjoint pixels can call this at the same time. */
+void gbufSetVaryings(
+        gbufBuffer *gbuf, int x, int y, int varyDim, const double vary[],
+		const double grads[4]) {
+	long k = x + (long)gbuf->width * y;
+	double *stored = &gbuf->varys[k * gbuf->varyDim];
+	for (int i = 0; i < varyDim; i += 1)
+		stored[i] = vary[i];
+	if (grads != NULL)
+		for (int i = 0; i < 4; i += 1)
+			gbuf->grads[k * 4 + i] = grads[i];
+	gbuf->generations[k] = gbuf->generation;
+}
+
+/* For gbufVARYINGS. Returns the varyings stored at pixel (x, y), which must be
+inside the buffer, or NULL if nothing has been drawn there since the last
+clear. */
+const double *gbufGetVaryings(const gbufBuffer *gbuf, int x, int y) {
+	long k = x + (long)gbuf->width * y;
+	if (gbuf->generations[k] != gbuf->generation)
+		return NULL;
+	return &gbuf->varys[k * gbuf->varyDim];
+}
+
+/* For gbufVARYINGS. Returns the four gradients stored with the varyings at
+pixel (x, y), which must be inside the buffer and must have been drawn with
+gradients since the last clear. */
+const double *gbufGetGradients(const gbufBuffer *gbuf, int x, int y) {
+	return &gbuf->grads[(x + (long)gbuf->width * y) * 4];
+}
+
+/* For gbufVISIBILITY. Stores the triangle drawn at pixel (x, y), which must be
+inside the buffer, and the weights p and q of its second and third vertices
+there. Threads that own disjoint pixels can call this at the same time. */
+void gbufSetVisibility(gbufBuffer *gbuf, int x, int y, int tri, double p,
+		double q) {
+	long k = x + (long)gbuf->width * y;
+	gbuf->visibilities[k].tri = tri;
+	gbuf->visibilities[k].p = p;
+	gbuf->visibilities[k].q = q;
+	gbuf->generations[k] = gbuf->generation;
+}
+
+/* For gbufVISIBILITY. Returns what is stored at pixel (x, y), which must be
+inside the buffer, or NULL if nothing has been drawn there since the last
+clear. */
+const gbufVisibility *gbufGetVisibility(const gbufBuffer *gbuf, int x, int y) {
+	long k = x + (long)gbuf->width * y;
+	if (gbuf->generations[k] != gbuf->generation)
+		return NULL;
+	return &gbuf->visibilities[k];
+}
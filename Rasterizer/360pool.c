@@ -0,0 +1,148 @@
+// Nathaniel Li
+
+
+/*** Creating and destroying ***/
+
+typedef struct poolPool poolPool;
+
+/* Private. One per worker thread, so that each worker knows its pool and its
+thread index. */
+typedef struct poolWorker poolWorker;
+struct poolWorker {
+	poolPool *pool;
+	int thread;
+	pthread_t handle;
+};
+
+/* A pool of worker threads that share out batches of independent jobs. The
+thread that calls poolRun works alongside the workers as thread 0, so a pool
+with threadNum 1 has no extra threads and simply runs every job in order. Feel
+free to read the struct's members, but don't write them. */
+struct poolPool {
+	int threadNum;
+	poolWorker *workers;			/* threadNum - 1 workers */
+	pthread_mutex_t mutex;
+	pthread_cond_t start, done;
+	int generation, busyNum, quitting;
+	/* The batch currently being run. */
+	int jobNum, nextJob;
+	void (*job)(void *data, int job, int thread);
+	void *data;
+};
+
+/* Private. Takes jobs from the current batch until there are none left. Must
+be called with the mutex held; returns with it held. */
+void poolWork(poolPool *pool, int thread) {
+	int job;
+	while (pool->nextJob < pool->jobNum) {
+		job = pool->nextJob;
+		pool->nextJob += 1;
+		pthread_mutex_unlock(&pool->mutex);
+		pool->job(pool->data, job, thread);
+		pthread_mutex_lock(&pool->mutex);
+	}
+}
+
+/* Private. The body of each worker thread. */
+void *poolWorkerMain(void *arg) {
+	poolWorker *worker = (poolWorker *)arg;
+	poolPool *pool = worker->pool;
+	int generation = 0;
+	pthread_mutex_lock(&pool->mutex);
+	while (1) {
+		while (pool->generation == generation && !pool->quitting)
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		if (pool->quitting)
+			break;
+		generation = pool->generation;
+		poolWork(pool, worker->thread);
+		pool->busyNum -= 1;
+		if (pool->busyNum == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+/* Initializes a pool of threadNum threads (counting the calling thread),
+starting threadNum - 1 worker threads that sleep until poolRun gives them work.
+Returns 0 on success, non-zero on failure. When you are finished with the pool,
+you must call poolFinalize to stop the workers. */
+int poolInitialize(poolPool *pool, int threadNum) {
+	int i;
+	if (threadNum < 1)
+		threadNum = 1;
+	pool->workers = (poolWorker *)malloc(threadNum * sizeof(poolWorker));
+	if (pool->workers == NULL) {
+		fprintf(stderr, "error: poolInitialize: malloc failed\n");
+		return 1;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->generation = 0;
+	pool->busyNum = 0;
+	pool->quitting = 0;
+	pool->jobNum = 0;
+	pool->nextJob = 0;
+	pool->threadNum = 1;
+	for (i = 1; i < threadNum; i += 1) {
+		pool->workers[i - 1].pool = pool;
+		pool->workers[i - 1].thread = i;
+		if (pthread_create(&pool->workers[i - 1].handle, NULL, poolWorkerMain,
+				&pool->workers[i - 1]) != 0) {
+			fprintf(stderr, "error: poolInitialize: pthread_create failed; "
+				"continuing with %d threads\n", pool->threadNum);
+			break;
+		}
+		pool->threadNum += 1;
+	}
+	return 0;
+}
+
+/* Stops the worker threads and deallocates the pool's resources. */
+void poolFinalize(poolPool *pool) {
+	int i;
+	pthread_mutex_lock(&pool->mutex);
+	pool->quitting = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+	for (i = 1; i < pool->threadNum; i += 1)
+		pthread_join(pool->workers[i - 1].handle, NULL);
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->workers);
+}
+
+
+
+/*** Regular use ***/
+
+/* Runs job(data, j, thread) for every j in 0, ..., jobNum - 1, spread over
+the pool's threads, and returns once all of them have finished. thread is the
+index (0 to threadNum - 1) of the thread running that job, so that jobs can
+keep per-thread scratch space. Jobs are handed out in increasing order, but
+with more than one thread they may finish in any order. */
+void poolRun(
+        poolPool *pool, int jobNum, void (*job)(void *data, int job, int thread),
+		void *data) {
+	int j;
+	if (pool->threadNum == 1 || jobNum <= 1) {
+		for (j = 0; j < jobNum; j += 1)
+			job(data, j, 0);
+		return;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	pool->job = job;
+	pool->data = data;
+	pool->jobNum = jobNum;
+	pool->nextJob = 0;
+	pool->busyNum = pool->threadNum - 1;
+	pool->generation += 1;
+	pthread_cond_broadcast(&pool->start);
+	poolWork(pool, 0);
+	while (pool->busyNum > 0)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,756 @@
+// Nathaniel Li
+
+
+/*** Creating and destroying ***/
+
+/* Screen tiles are renTILESIZE x renTILESIZE pixels. Threads may rasterize 
+different tiles at once only because no tile of the depth buffer's coarsest 
+level, nor of the frame buffer, straddles two screen tiles, so the size is 
+derived from the depth buffer's rather than chosen on its own. */
+#define renTILESIZE (1 << (depthLEVELSHIFT * depthLEVELNUM))
+#if frameTILESHIFT > depthLEVELSHIFT * depthLEVELNUM
+#error "renTILESIZE must be a multiple of frameTILESIZE"
+#endif
+
+/* Vertices are shaded renVERTCHUNK at a time. */
+#define renVERTCHUNK 256
+
+/* Deferred shading gives shaders with shadeFragments up to renFRAGCHUNK pixels 
+at a time. */
+#define renFRAGCHUNK 64
+
+/* The post-transform vertex buffer starts on a renALIGNMENT-byte boundary, so
+that it lines up with cache lines. */
+#define renALIGNMENT 64
+
+/* The default guard band. */
+#define renGUARDBAND 4.0
+
+/* The values of deferred. */
+#define renFORWARD 0
+#define renDEFERRED 1
+#define renVISIBILITY 2
+
+/* Pipeline statistics, like a GPU's query objects, counting what each stage
+of meshRender did. Of the triangleNum triangles submitted, culledNum faced the
+wrong way, rejectedNum lay outside the view volume (or were clipped away to
+nothing), clippedOneNum were clipped into one triangle and clippedTwoNum into
+two or more, and rasterizedNum screen triangles reached the rasterizer. The
+counters say what then happened to their pixels. The times are in seconds:
+vertexTime is spent shading vertices, primitiveTime culling, clipping, and
+binning triangles, and rasterTime rasterizing and shading fragments. With one
+thread, triangles are rasterized as soon as they are clipped, so timing them
+separately takes two clock reads per triangle; that only happens after
+renSetTiming, and otherwise their time is part of primitiveTime. The deferred
+shading pass always counts as rasterTime. */
+typedef struct renStatistics renStatistics;
+struct renStatistics {
+	long vertexNum, triangleNum, culledNum, rejectedNum;
+	long clippedOneNum, clippedTwoNum, rasterizedNum;
+	triCounters counters;
+	double vertexTime, primitiveTime, rasterTime;
+};
+
+/* A renderer holds the state that meshRender keeps from frame to frame. With
+one thread, meshRender rasterizes each triangle as soon as it is clipped. With
+more threads, the clipped screen-space triangles are first sorted into
+renTILESIZE x renTILESIZE screen tiles, and then the pool's threads rasterize
+whole tiles at once. Each tile owns its pixels in the depth and frame buffers,
+and its triangles are drawn in submission order, so the output is identical to
+the single-threaded path. The renderer also keeps the shaded vertices of the
+mesh being rendered, in a buffer that only grows, so that meshes are limited by
+the heap rather than the stack. The pool's threads shade them renVERTCHUNK at a
+time, so vertex shaders, like fragment shaders, may run on several threads at
+once. Every meshRender adds to stats, until renClearStatistics, so they can
+cover one mesh or a whole frame.
+Triangles that cross the near or far plane are clipped, but at the sides they
+are only clipped once they reach guardBand times the size of the screen, from
+its center. Inside that band, the rasterizer just skips their off-screen
+pixels. If subpixelBits is positive, the rasterizer snaps vertices to a grid of
+1 / 2^subpixelBits pixels and computes coverage in integers. If deferred is not
+renFORWARD, then each meshRender with shaEARLYDEPTH first rasterizes only
+depths and either varyings (renDEFERRED) or triangle indices and weights
+(renVISIBILITY) into the G-buffer gbuf, and then runs the fragment shader once
+for each pixel that ends up visible, in bands of rows spread over the pool's
+threads. A visibility buffer refers to the screen-space triangles, which are
+then kept until renEnd even with one thread. Feel free to read the struct's
+members, but don't write them, except through the accessors below. */
+typedef struct renRenderer renRenderer;
+struct renRenderer {
+	int threadNum;
+	poolPool pool;
+	double guardBand;
+	int subpixelBits;
+	int timing;
+	int deferred;
+	renStatistics stats;
+	triCounters *threadCounters;	/* threadNum counters, one per thread */
+	double *varys;					/* varyCap doubles */
+	long varyCap;
+	/* Streams for shaders with shadeVertices: for each thread, renVERTCHUNK 
+	doubles for each attribute and then each varying. */
+	double *streams;				/* streamCap doubles */
+	long streamCap;
+	/* Deferred shading state, used only when deferred is set. */
+	int deferring;
+	gbufBuffer gbuf;
+	/* Screen-space triangles, kept when binning or for a visibility buffer. */
+	int triNum, triCap, varyDim;
+	double *tris;					/* triCap * 3 * varyDim doubles */
+	/* Binning state, used only when threadNum > 1. */
+	int binning;
+	int tileCols, tileRows, tileCap;
+	int *binNums, *binCaps;			/* tileCap ints each */
+	int **bins;						/* tileCap arrays of triangle indices */
+};
+
+/* Sets all of the statistics to zero. */
+void renClearStatistics(renRenderer *ren) {
+	ren->stats.vertexNum = 0;
+	ren->stats.triangleNum = 0;
+	ren->stats.culledNum = 0;
+	ren->stats.rejectedNum = 0;
+	ren->stats.clippedOneNum = 0;
+	ren->stats.clippedTwoNum = 0;
+	ren->stats.rasterizedNum = 0;
+	triClearCounters(&ren->stats.counters);
+	ren->stats.vertexTime = 0.0;
+	ren->stats.primitiveTime = 0.0;
+	ren->stats.rasterTime = 0.0;
+}
+
+/* Returns the overdraw of the statistics so far: the number of pixels written
+per pixel of the buffer. */
+double renGetOverdraw(const renRenderer *ren, const depthBuffer *buf) {
+	return ren->stats.counters.passedNum / ((double)buf->width * buf->height);
+}
+
+/* Initializes a renderer that uses threadNum threads (counting the calling
+thread). Returns 0 on success, non-zero on failure. When you are finished with
+the renderer, you must call renFinalize to deallocate its resources. */
+int renInitialize(renRenderer *ren, int threadNum) {
+	if (threadNum < 1)
+		threadNum = 1;
+	ren->threadCounters = (triCounters *)malloc(threadNum * sizeof(triCounters));
+	if (ren->threadCounters == NULL) {
+		fprintf(stderr, "error: renInitialize: malloc failed\n");
+		return 1;
+	}
+	if (poolInitialize(&ren->pool, threadNum) != 0) {
+		free(ren->threadCounters);
+		return 2;
+	}
+	ren->threadNum = ren->pool.threadNum;
+	ren->guardBand = renGUARDBAND;
+	ren->subpixelBits = 0;
+	ren->timing = 0;
+	ren->deferred = 0;
+	renClearStatistics(ren);
+	ren->deferring = 0;
+	ren->gbuf.varys = NULL;
+	ren->gbuf.visibilities = NULL;
+	ren->gbuf.generations = NULL;
+	ren->binning = 0;
+	ren->tileCols = 0;
+	ren->tileRows = 0;
+	ren->tileCap = 0;
+	ren->triNum = 0;
+	ren->triCap = 0;
+	ren->varyDim = 0;
+	ren->tris = NULL;
+	ren->varys = NULL;
+	ren->varyCap = 0;
+	ren->streams = NULL;
+	ren->streamCap = 0;
+	ren->binNums = NULL;
+	ren->binCaps = NULL;
+	ren->bins = NULL;
+	return 0;
+}
+
+/* Deallocates the resources backing the renderer. */
+void renFinalize(renRenderer *ren) {
+	int i;
+	poolFinalize(&ren->pool);
+	for (i = 0; i < ren->tileCap; i += 1)
+		free(ren->bins[i]);
+	free(ren->bins);
+	free(ren->binCaps);
+	free(ren->binNums);
+	free(ren->tris);
+	free(ren->varys);
+	free(ren->streams);
+	free(ren->threadCounters);
+	gbufFinalize(&ren->gbuf);
+}
+
+/* Changes the number of threads used by meshRender. Do not call it during
+meshRender. Returns 0 on success, non-zero on failure (in which case the
+renderer falls back to one thread). */
+int renSetThreadNum(renRenderer *ren, int threadNum) {
+	if (threadNum < 1)
+		threadNum = 1;
+	if (threadNum == ren->threadNum)
+		return 0;
+	poolFinalize(&ren->pool);
+	triCounters *threadCounters = (triCounters *)realloc(ren->threadCounters,
+		threadNum * sizeof(triCounters));
+	if (threadCounters == NULL || poolInitialize(&ren->pool, threadNum) != 0) {
+		fprintf(stderr, "error: renSetThreadNum: falling back to one thread\n");
+		if (threadCounters != NULL)
+			ren->threadCounters = threadCounters;
+		poolInitialize(&ren->pool, 1);
+		ren->threadNum = 1;
+		return 1;
+	}
+	ren->threadCounters = threadCounters;
+	ren->threadNum = ren->pool.threadNum;
+	return 0;
+}
+
+/* Sets the guard band, which must be at least 1. Larger bands clip fewer
+triangles, but let larger screen coordinates reach the rasterizer. */
+void renSetGuardBand(renRenderer *ren, double guardBand) {
+	ren->guardBand = (guardBand < 1.0 ? 1.0 : guardBand);
+}
+
+/* Sets the number of fractional bits in snapped screen coordinates, at most
+triSUBPIXELBITSMAX. With 0, the default, vertices are not snapped, and
+coverage is computed in double precision. 8 bits is a typical choice. */
+void renSetSubpixelBits(renRenderer *ren, int subpixelBits) {
+	ren->subpixelBits = min(max(subpixelBits, 0), triSUBPIXELBITSMAX);
+}
+
+/* Turns timing of the rasterizer on (1) or off (0, the default). With more
+than one thread, rasterTime is always measured, because it costs two clock
+reads per frame. With one thread it costs two per triangle, so it is off
+unless this asks for it. */
+void renSetTiming(renRenderer *ren, int timing) {
+	ren->timing = timing;
+}
+
+/* Sets how fragments are shaded: renFORWARD (the default) as they are
+rasterized, or renDEFERRED or renVISIBILITY after rasterizing. Deferred shading
+runs the fragment shader once per visible pixel, however many triangles cover
+it. renDEFERRED stores every pixel's varyings in between, so its output is
+the same as forward shading's. renVISIBILITY stores only 24 bytes per pixel
+and interpolates the varyings again when shading, from the stored triangles.
+Then they are interpolated directly at each pixel, rather than stepped along
+its span, so its output only approximately equals forward shading's: the
+varyings differ in their last bits, which is enough for texNEAREST to pick the
+neighboring texel wherever a texture coordinate lies on a texel boundary, so a
+few pixels per frame can differ. Deferring applies only to shadings with
+shaEARLYDEPTH, because it tests the interpolated depth vary[2], and it saves
+nothing across meshRender calls, since each mesh is shaded at its own renEnd.
+Other shadings are rendered forward as usual. */
+void renSetDeferred(renRenderer *ren, int deferred) {
+	ren->deferred = deferred;
+}
+
+
+
+/*** Vertex shading ***/
+
+/* Private. Returns the time in seconds, from an arbitrary starting point. */
+double renGetTime(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1.0e-9;
+}
+
+/* Private. Makes room for vertNum vertices of varyDim varyings each, and for
+every thread's streams for a shader with attrDim attributes, if it has
+shadeVertices. Returns 0 on success, non-zero on failure. */
+int renReserveVaryings(
+        renRenderer *ren, int vertNum, int attrDim, int varyDim, int streaming) {
+	long varyNum = (long)vertNum * varyDim;
+	long streamNum = (long)ren->threadNum * (attrDim + varyDim) * renVERTCHUNK;
+	void *varys;
+	/* The old contents are not needed, so there is nothing to copy. */
+	if (varyNum > ren->varyCap) {
+		if (posix_memalign(&varys, renALIGNMENT, varyNum * sizeof(double)) != 0) {
+			fprintf(stderr, "error: renReserveVaryings: posix_memalign failed\n");
+			return 1;
+		}
+		free(ren->varys);
+		ren->varys = (double *)varys;
+		ren->varyCap = varyNum;
+	}
+	if (streaming && streamNum > ren->streamCap) {
+		if (posix_memalign(&varys, renALIGNMENT, streamNum * sizeof(double)) != 0) {
+			fprintf(stderr, "error: renReserveVaryings: posix_memalign failed\n");
+			return 2;
+		}
+		free(ren->streams);
+		ren->streams = (double *)varys;
+		ren->streamCap = streamNum;
+	}
+	return 0;
+}
+
+/* Private. Shades vertices chunk * renVERTCHUNK onwards, up to renVERTCHUNK of
+them, from the vertNum vertices of attrDim attributes each in attrs. A shader
+with shadeVertices gets the whole chunk at once, rearranged into the given
+thread's streams. */
+void renShadeChunk(
+        renRenderer *ren, const shaShading *sha, const double unif[],
+		int vertNum, const double attrs[], int chunk, int thread) {
+	int first = chunk * renVERTCHUNK, last = min(vertNum, first + renVERTCHUNK);
+	int attrDim = sha->attrDim, varyDim = sha->varyDim, i, k;
+	if (sha->shadeVertices == NULL) {
+		for (i = first; i < last; i += 1)
+			sha->shadeVertex(sha->unifDim, unif, attrDim,
+				&attrs[(long)i * attrDim], varyDim, &ren->varys[(long)i * varyDim]);
+		return;
+	}
+	int num = last - first;
+	const double *attr = &attrs[(long)first * attrDim];
+	double *vary = &ren->varys[(long)first * varyDim], *stream;
+	double *streams = &ren->streams[(long)thread * (attrDim + varyDim) * renVERTCHUNK];
+	const double *attrStreams[attrDim];
+	double *varyStreams[varyDim];
+	for (k = 0; k < attrDim; k += 1) {
+		stream = &streams[k * renVERTCHUNK];
+		for (i = 0; i < num; i += 1)
+			stream[i] = attr[i * attrDim + k];
+		attrStreams[k] = stream;
+	}
+	for (k = 0; k < varyDim; k += 1)
+		varyStreams[k] = &streams[(attrDim + k) * renVERTCHUNK];
+	sha->shadeVertices(num, sha->unifDim, unif, attrDim, attrStreams, varyDim,
+		varyStreams);
+	for (k = 0; k < varyDim; k += 1) {
+		stream = varyStreams[k];
+		for (i = 0; i < num; i += 1)
+			vary[i * varyDim + k] = stream[i];
+	}
+}
+
+/* Private. Everything that the vertex jobs need to know. */
+typedef struct renVertexJob renVertexJob;
+struct renVertexJob {
+	renRenderer *ren;
+	const shaShading *sha;
+	const double *unif;
+	int vertNum;
+	const double *attrs;
+};
+
+/* Private. Shades one chunk of vertices. */
+void renShadeJob(void *data, int chunk, int thread) {
+	renVertexJob *job = (renVertexJob *)data;
+	renShadeChunk(job->ren, job->sha, job->unif, job->vertNum, job->attrs,
+		chunk, thread);
+}
+
+/* Runs the vertex shader on vertNum vertices, whose attributes are stored one
+after another in attrs, in chunks of renVERTCHUNK spread over the pool's
+threads. Uses the shader's shadeVertices if it has one, and shadeVertex
+otherwise. Returns the varyings of the vertices, one after another, or NULL on
+failure. They stay valid until the next call. */
+double *renShadeVertices(
+        renRenderer *ren, const shaShading *sha, const double unif[],
+		int vertNum, const double attrs[]) {
+	if (renReserveVaryings(ren, vertNum, sha->attrDim, sha->varyDim,
+			sha->shadeVertices != NULL) != 0)
+		return NULL;
+	double start = renGetTime();
+	renVertexJob job = {ren, sha, unif, vertNum, attrs};
+	poolRun(&ren->pool, (vertNum + renVERTCHUNK - 1) / renVERTCHUNK, renShadeJob,
+		&job);
+	ren->stats.vertexNum += vertNum;
+	ren->stats.vertexTime += renGetTime() - start;
+	return ren->varys;
+}
+
+
+
+/*** Binning ***/
+
+/* Private. Makes room for the tiles of a width x height buffer and empties
+them. Returns 0 on success, non-zero on failure. */
+int renBeginBins(renRenderer *ren, int width, int height) {
+	int tileNum, i;
+	ren->tileCols = (width + renTILESIZE - 1) / renTILESIZE;
+	ren->tileRows = (height + renTILESIZE - 1) / renTILESIZE;
+	tileNum = ren->tileCols * ren->tileRows;
+	if (tileNum > ren->tileCap) {
+		int *binNums = (int *)realloc(ren->binNums, tileNum * sizeof(int));
+		if (binNums != NULL)
+			ren->binNums = binNums;
+		int *binCaps = (int *)realloc(ren->binCaps, tileNum * sizeof(int));
+		if (binCaps != NULL)
+			ren->binCaps = binCaps;
+		int **bins = (int **)realloc(ren->bins, tileNum * sizeof(int *));
+		if (bins != NULL)
+			ren->bins = bins;
+		if (binNums == NULL || binCaps == NULL || bins == NULL) {
+			fprintf(stderr, "error: renBeginBins: realloc failed\n");
+			return 1;
+		}
+		for (i = ren->tileCap; i < tileNum; i += 1) {
+			ren->binCaps[i] = 0;
+			ren->bins[i] = NULL;
+		}
+		ren->tileCap = tileNum;
+	}
+	for (i = 0; i < tileNum; i += 1)
+		ren->binNums[i] = 0;
+	return 0;
+}
+
+/* Private. Empties the stored triangles, which will have varyDim varyings per
+vertex. */
+void renBeginTriangles(renRenderer *ren, int varyDim) {
+	if (varyDim != ren->varyDim) {
+		/* The stored triangles have the wrong shape, so start them over. */
+		free(ren->tris);
+		ren->tris = NULL;
+		ren->triCap = 0;
+		ren->varyDim = varyDim;
+	}
+	ren->triNum = 0;
+}
+
+/* Private. Stores a screen-space triangle. Returns its index, or -1 on
+failure. */
+int renStoreTriangle(
+        renRenderer *ren, const double a[], const double b[], const double c[]) {
+	int varyDim = ren->varyDim;
+	if (ren->triNum == ren->triCap) {
+		if (ren->triCap >= (1 << 30)) {
+			fprintf(stderr, "error: renStoreTriangle: too many triangles\n");
+			return -1;
+		}
+		int cap = (ren->triCap == 0 ? 1024 : 2 * ren->triCap);
+		double *tris = (double *)realloc(ren->tris,
+			(size_t)cap * 3 * varyDim * sizeof(double));
+		if (tris == NULL) {
+			fprintf(stderr, "error: renStoreTriangle: realloc failed\n");
+			return -1;
+		}
+		ren->tris = tris;
+		ren->triCap = cap;
+	}
+	double *tri = &ren->tris[(long)ren->triNum * 3 * varyDim];
+	vecCopy(varyDim, a, tri);
+	vecCopy(varyDim, b, &tri[varyDim]);
+	vecCopy(varyDim, c, &tri[2 * varyDim]);
+	ren->triNum += 1;
+	return ren->triNum - 1;
+}
+
+/* Private. Rasterizes triangle number tri, within the scissor rectangle, in
+fixed or floating point according to the renderer's settings, and into the
+G-buffer if the frame is deferred. */
+void renRasterize(
+        renRenderer *ren, const shaShading *sha, frameBuffer *frame,
+		depthBuffer *buf, const double unif[], const texTexture *tex[],
+		const double a[], const double b[], const double c[], int tri,
+		const int scissor[4], triCounters *counters) {
+	gbufBuffer *gbuf = (ren->deferring ? &ren->gbuf : NULL);
+	if (ren->subpixelBits > 0)
+		triRenderFixed(sha, frame, gbuf, buf, unif, tex, a, b, c, tri,
+			ren->subpixelBits, scissor, counters);
+	else
+		triRenderScissor(sha, frame, gbuf, buf, unif, tex, a, b, c, tri,
+			scissor, counters);
+}
+
+/* Private. Appends triangle index tri to the given tile's bin. Returns 0 on
+success, non-zero on failure. */
+int renAddToBin(renRenderer *ren, int tile, int tri) {
+	if (ren->binNums[tile] == ren->binCaps[tile]) {
+		int cap = (ren->binCaps[tile] == 0 ? 64 : 2 * ren->binCaps[tile]);
+		int *bin = (int *)realloc(ren->bins[tile], cap * sizeof(int));
+		if (bin == NULL) {
+			fprintf(stderr, "error: renAddToBin: realloc failed\n");
+			return 1;
+		}
+		ren->bins[tile] = bin;
+		ren->binCaps[tile] = cap;
+	}
+	ren->bins[tile][ren->binNums[tile]] = tri;
+	ren->binNums[tile] += 1;
+	return 0;
+}
+
+/* Private. Stores a screen-space triangle and adds it to the bin of every tile
+that its bounding box touches. If memory runs out, the triangle is rasterized
+right away instead, on the calling thread, where it is missing from bins; no
+tile jobs run until renEnd, so that is safe. Only a visibility buffer can't do
+without the stored triangle. Returns 0 on success, non-zero if the triangle
+could not be rendered. */
+int renBinTriangle(
+        renRenderer *ren, const shaShading *sha, frameBuffer *frame,
+		depthBuffer *buf, const double unif[], const texTexture *tex[],
+		const double a[], const double b[], const double c[]) {
+	/* The rasterizer only visits pixels inside the bounding box. Pad it by a
+	pixel in case rounding nudges an edge across a tile boundary. */
+	double xLow = fmin(a[0], fmin(b[0], c[0])) - 1.0;
+	double xHigh = fmax(a[0], fmax(b[0], c[0])) + 1.0;
+	double yLow = fmin(a[1], fmin(b[1], c[1])) - 1.0;
+	double yHigh = fmax(a[1], fmax(b[1], c[1])) + 1.0;
+	if (xHigh < 0.0 || yHigh < 0.0 || xLow >= buf->width ||
+			yLow >= buf->height)
+		return 0;
+	int tri = renStoreTriangle(ren, a, b, c);
+	if (tri < 0) {
+		if (ren->deferring && ren->gbuf.format == gbufVISIBILITY)
+			return 1;
+		int scissor[4] = {0, buf->width - 1, 0, buf->height - 1};
+		renRasterize(ren, sha, frame, buf, unif, tex, a, b, c, tri, scissor,
+			&ren->stats.counters);
+		return 0;
+	}
+	int colLow = (int)fmax(xLow, 0.0) / renTILESIZE;
+	int colHigh = (int)fmin(xHigh, buf->width - 1) / renTILESIZE;
+	int rowLow = (int)fmax(yLow, 0.0) / renTILESIZE;
+	int rowHigh = (int)fmin(yHigh, buf->height - 1) / renTILESIZE;
+	for (int row = rowLow; row <= rowHigh; row += 1)
+		for (int col = colLow; col <= colHigh; col += 1)
+			if (renAddToBin(ren, col + ren->tileCols * row, tri) != 0) {
+				int scissor[4] = {
+					col * renTILESIZE,
+					min(buf->width, (col + 1) * renTILESIZE) - 1,
+					row * renTILESIZE,
+					min(buf->height, (row + 1) * renTILESIZE) - 1};
+				renRasterize(ren, sha, frame, buf, unif, tex, a, b, c, tri,
+					scissor, &ren->stats.counters);
+			}
+	return 0;
+}
+
+
+
+/*** Rendering ***/
+
+/* Private. Everything that the tile jobs need to know. */
+typedef struct renTileJob renTileJob;
+struct renTileJob {
+	renRenderer *ren;
+	const shaShading *sha;
+	frameBuffer *frame;
+	depthBuffer *buf;
+	const double *unif;
+	const texTexture **tex;
+};
+
+/* Private. Rasterizes every triangle in one tile's bin, clipped to the tile. */
+void renRenderTile(void *data, int tile, int thread) {
+	renTileJob *job = (renTileJob *)data;
+	renRenderer *ren = job->ren;
+	int varyDim = ren->varyDim;
+	int col = tile % ren->tileCols, row = tile / ren->tileCols;
+	int scissor[4] = {
+		col * renTILESIZE,
+		min(job->buf->width, (col + 1) * renTILESIZE) - 1,
+		row * renTILESIZE,
+		min(job->buf->height, (row + 1) * renTILESIZE) - 1};
+	for (int i = 0; i < ren->binNums[tile]; i += 1) {
+		int index = ren->bins[tile][i];
+		const double *tri = &ren->tris[(long)index * 3 * varyDim];
+		renRasterize(ren, job->sha, job->frame, job->buf, job->unif, job->tex,
+			tri, &tri[varyDim], &tri[2 * varyDim], index, scissor,
+			&ren->threadCounters[thread]);
+	}
+}
+
+/* Private. Interpolates the varyings of a visibility buffer's pixel into
+vary, from its stored triangle. */
+void renInterpolate(
+        const renRenderer *ren, const gbufVisibility *visibility, double vary[]) {
+	int varyDim = ren->varyDim;
+	const double *a = &ren->tris[(long)visibility->tri * 3 * varyDim];
+	const double *b = &a[varyDim], *c = &a[2 * varyDim];
+	double p = visibility->p, q = visibility->q;
+	for (int i = 0; i < varyDim; i += 1)
+		vary[i] = a[i] + p * (b[i] - a[i]) + q * (c[i] - a[i]);
+}
+
+/* Private. Shades the fragNum fragments whose varyings have been gathered into
+the streams varys, at pixels (xs[f], y), with the shader's shadeFragments, and
+draws them. */
+void renShadeFragments(
+        renTileJob *job, int fragNum, const double *varys[], double *rgbds[],
+		const int xs[], int y) {
+	const shaShading *sha = job->sha;
+	sha->shadeFragments(fragNum, sha->unifDim, job->unif, sha->texNum, job->tex,
+		sha->varyDim, varys, rgbds);
+	for (int f = 0; f < fragNum; f += 1)
+		frameSetRGB(job->frame, xs[f], y, rgbds[0][f], rgbds[1][f], rgbds[2][f]);
+}
+
+/* Private. Runs the fragment shader on every drawn pixel in one band of
+frameTILESIZE rows of the G-buffer. The bands line up with the frame buffer's
+tiles, so no two threads ever fill in the same tile. If the shading has
+texture coordinates and some texture is filtered with texTRILINEAR, the
+textures' levels of detail come from the stored triangle of a visibility
+buffer, or from the gradients stored with the varyings otherwise, so that they
+match forward shading's. Otherwise, a shader with shadeFragments gets each
+row's drawn pixels renFRAGCHUNK at a time. */
+void renResolveBand(void *data, int band, int thread) {
+	renTileJob *job = (renTileJob *)data;
+	renRenderer *ren = job->ren;
+	const shaShading *sha = job->sha;
+	const gbufVisibility *visibility = NULL;
+	const double *vary;
+	double rgbd[4], interpolated[sha->varyDim], grads[4];
+	const double *lodGrads = grads;
+	long shadedNum = 0;
+	int index = sha->texCoordIndex, texNum = (sha->texNum > 0 ? sha->texNum : 1);
+	int lodding = 0;
+	/* The levels of detail only matter to trilinear filtering. */
+	for (int k = 0; k < sha->texNum && index >= 4; k += 1)
+		lodding |= (job->tex[k]->filtering == texTRILINEAR);
+	texTexture views[texNum];
+	const texTexture *viewPtrs[texNum];
+	const texTexture **tex = (lodding ? viewPtrs : job->tex);
+	/* Streams of renFRAGCHUNK varyings each, and then of rgbd channels. */
+	int batching = (sha->shadeFragments != NULL && !lodding);
+	int varyDim = sha->varyDim, xs[renFRAGCHUNK], fragNum = 0;
+	double streams[batching ? (varyDim + 4) * renFRAGCHUNK : 1];
+	const double *varyStreams[varyDim];
+	double *rgbdStreams[4];
+	for (int k = 0; k < varyDim && batching; k += 1)
+		varyStreams[k] = &streams[k * renFRAGCHUNK];
+	for (int k = 0; k < 4 && batching; k += 1)
+		rgbdStreams[k] = &streams[(varyDim + k) * renFRAGCHUNK];
+	int yMax = min(job->buf->height, (band + 1) * frameTILESIZE);
+	for (int y = band * frameTILESIZE; y < yMax; y += 1) {
+		for (int x = 0; x < job->buf->width; x += 1) {
+			if (ren->gbuf.format == gbufVISIBILITY) {
+				visibility = gbufGetVisibility(&ren->gbuf, x, y);
+				vary = NULL;
+				if (visibility != NULL) {
+					renInterpolate(ren, visibility, interpolated);
+					vary = interpolated;
+				}
+			} else
+				vary = gbufGetVaryings(&ren->gbuf, x, y);
+			if (vary != NULL && batching) {
+				for (int k = 0; k < varyDim; k += 1)
+					streams[k * renFRAGCHUNK + fragNum] = vary[k];
+				xs[fragNum] = x;
+				fragNum += 1;
+				if (fragNum == renFRAGCHUNK) {
+					renShadeFragments(job, fragNum, varyStreams, rgbdStreams, xs,
+						y);
+					fragNum = 0;
+				}
+				shadedNum += 1;
+			} else if (vary != NULL) {
+				if (lodding && visibility != NULL) {
+					const double *a =
+						&ren->tris[(long)visibility->tri * 3 * ren->varyDim];
+					const double *b = &a[ren->varyDim], *c = &a[2 * ren->varyDim];
+					triGetGradient(a, b, c, index, &grads[0]);
+					triGetGradient(a, b, c, index + 1, &grads[2]);
+				} else if (lodding)
+					lodGrads = gbufGetGradients(&ren->gbuf, x, y);
+				if (lodding)
+					triSetLODs(sha->texNum, job->tex, &lodGrads[0], &lodGrads[2],
+						views, viewPtrs);
+				sha->shadeFragment(sha->unifDim, job->unif, sha->texNum,
+					tex, sha->varyDim, vary, rgbd);
+				frameSetRGB(job->frame, x, y, rgbd[0], rgbd[1], rgbd[2]);
+				shadedNum += 1;
+			}
+		}
+		if (fragNum > 0)
+			renShadeFragments(job, fragNum, varyStreams, rgbdStreams, xs, y);
+		fragNum = 0;
+	}
+	/* The raster pass counted every covered pixel as rejected early. */
+	ren->threadCounters[thread].shadedNum += shadedNum;
+	ren->threadCounters[thread].earlyRejectNum -= shadedNum;
+}
+
+/* Private. Makes the G-buffer width x height, in the given format, with room
+for varyDim varyings, and clears it. Returns 0 on success, non-zero on
+failure. */
+int renBeginGBuffer(
+        renRenderer *ren, int width, int height, int format, int varyDim) {
+	gbufBuffer *gbuf = &ren->gbuf;
+	if (gbuf->generations == NULL || gbuf->width != width ||
+			gbuf->height != height || gbuf->format != format ||
+			(format == gbufVARYINGS && gbuf->varyDim < varyDim)) {
+		gbufFinalize(gbuf);
+		if (gbufInitialize(gbuf, width, height, format, varyDim) != 0)
+			return 1;
+	} else
+		gbufClear(gbuf);
+	return 0;
+}
+
+/* Starts a frame of meshRender. Returns 0 on success, non-zero on failure (in
+which case the frame is rendered on one thread). If the G-buffer can't be
+allocated, the frame is rendered forward instead of deferred. */
+int renBegin(renRenderer *ren, const depthBuffer *buf, const shaShading *sha) {
+	ren->binning = 0;
+	ren->deferring = 0;
+	if (ren->deferred != renFORWARD && sha->depthMode == shaEARLYDEPTH)
+		ren->deferring = (renBeginGBuffer(ren, buf->width, buf->height,
+			(ren->deferred == renVISIBILITY ? gbufVISIBILITY : gbufVARYINGS),
+			sha->varyDim) == 0);
+	renBeginTriangles(ren, sha->varyDim);
+	if (ren->threadNum == 1)
+		return 0;
+	if (renBeginBins(ren, buf->width, buf->height) != 0)
+		return 1;
+	ren->binning = 1;
+	return 0;
+}
+
+/* Takes one clipped screen-space triangle from meshRender. With one thread it
+is rasterized right away; otherwise it is binned until renEnd. Returns 0 on
+success, non-zero if memory ran out for a visibility buffer's triangle, which
+then is not rendered. */
+int renTriangle(
+        renRenderer *ren, const shaShading *sha, frameBuffer *frame,
+		depthBuffer *buf, const double unif[], const texTexture *tex[],
+		const double a[], const double b[], const double c[]) {
+	ren->stats.rasterizedNum += 1;
+	if (!ren->binning) {
+		int scissor[4] = {0, buf->width - 1, 0, buf->height - 1}, tri = -1;
+		if (ren->deferring && ren->gbuf.format == gbufVISIBILITY) {
+			tri = renStoreTriangle(ren, a, b, c);
+			if (tri < 0)
+				return 1;
+		}
+		if (ren->timing) {
+			double start = renGetTime();
+			renRasterize(ren, sha, frame, buf, unif, tex, a, b, c, tri, scissor,
+				&ren->stats.counters);
+			ren->stats.rasterTime += renGetTime() - start;
+		} else
+			renRasterize(ren, sha, frame, buf, unif, tex, a, b, c, tri, scissor,
+				&ren->stats.counters);
+		return 0;
+	}
+	return renBinTriangle(ren, sha, frame, buf, unif, tex, a, b, c);
+}
+
+/* Finishes a frame of meshRender, by rasterizing all of the binned triangles
+across the pool's threads, and then shading the G-buffer if it is deferred. */
+void renEnd(
+        renRenderer *ren, const shaShading *sha, frameBuffer *frame,
+		depthBuffer *buf, const double unif[], const texTexture *tex[]) {
+	if (!ren->binning && !ren->deferring)
+		return;
+	renTileJob job = {ren, sha, frame, buf, unif, tex};
+	for (int i = 0; i < ren->threadNum; i += 1)
+		triClearCounters(&ren->threadCounters[i]);
+	double start = renGetTime();
+	if (ren->binning && ren->triNum > 0)
+		poolRun(&ren->pool, ren->tileCols * ren->tileRows, renRenderTile, &job);
+	if (ren->deferring)
+		poolRun(&ren->pool, (buf->height + frameTILESIZE - 1) / frameTILESIZE,
+			renResolveBand, &job);
+	ren->stats.rasterTime += renGetTime() - start;
+	for (int i = 0; i < ren->threadNum; i += 1)
+		triAddCounters(&ren->stats.counters, &ren->threadCounters[i]);
+	ren->triNum = 0;
+	ren->binning = 0;
+	ren->deferring = 0;
+}
@@ -0,0 +1,357 @@
+// Nathaniel Li
+
+/* A benchmark of the rasterizer, on the landscape scene of 350mainClipping.c.
+For each landscape size, it builds a landscape from a fixed seed, flies the
+camera along a fixed path over it, and times every frame. The results are
+printed to stdout as JSON, so that runs can be compared from commit to commit.
+Progress and errors go to stderr. As for 350mainClipping.c, the files shared
+with the raytracer are in ../Raytracer. On Ubuntu, compile with...
+    cc -O2 -I../Raytracer 370mainBenchmark.c ../Raytracer/040pixelHeadless.c -lm -lpthread
+or with 040pixel.o and the graphics libraries, as for 350mainClipping.c, to
+watch it in a window. Run with optional thread and frame counts, followed by
+optional landscape sizes, for example
+    ./a.out 8 120 40 512 2048
+The default sizes are benchSIZES. Each one needs about 175 * size * size bytes
+of memory, so 4096 needs about 3 GB. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "040pixel.h"
+
+#include "250vector.c"
+#include "280matrix.c"
+#include "150texture.c"
+#include "260shading.c"
+#include "040frame.c"
+#include "260depth.c"
+#include "360gbuffer.c"
+#include "270triangle.c"
+#include "360pool.c"
+#include "360renderer.c"
+#include "350mesh.c"
+#include "190mesh2D.c"
+#include "250mesh3D.c"
+#include "300isometry.c"
+#include "300camera.c"
+#include "340landscape.c"
+
+#define benchWIDTH 512
+#define benchHEIGHT 512
+#define benchSEED 311
+#define benchFRAMES 60
+#define benchWARMUPS 2
+/* The texture's filtering. Try texTRILINEAR, to sample distant terrain from
+small mipmap levels. */
+#define benchFILTERING texNEAREST
+/* How fragments are shaded. Try renDEFERRED or renVISIBILITY, to shade each 
+visible pixel once, in batches with shadeFragments. */
+#define benchDEFERRED renFORWARD
+#define benchSIZENUM 6
+const int benchSIZES[benchSIZENUM] = {40, 128, 512, 1024, 2048, 4096};
+
+#define ATTRX 0
+#define ATTRY 1
+#define ATTRZ 2
+#define ATTRS 3
+#define ATTRT 4
+#define ATTRN 5
+#define ATTRO 6
+#define ATTRP 7
+#define VARYX 0
+#define VARYY 1
+#define VARYZ 2
+#define VARYW 3
+#define VARYS 4
+#define VARYT 5
+#define VARYN 6
+#define VARYO 7
+#define VARYP 8
+#define UNIFMODELING 0
+#define UNIFPROJINVISOM 16
+
+/* The same shaders as in 350mainClipping.c. */
+void shadeVertex(
+        int unifDim, const double unif[], int attrDim, const double attr[],
+        int varyDim, double vary[]) {
+	double attrHomog[4] = {attr[ATTRX], attr[ATTRY], attr[ATTRZ], 1.0};
+	double modHomog[4];
+	mat441Multiply((double(*)[4])(&unif[UNIFMODELING]), attrHomog, modHomog);
+	mat441Multiply((double(*)[4])(&unif[UNIFPROJINVISOM]), modHomog, vary);
+	vecCopy(5, &attr[ATTRS], &vary[VARYS]);
+}
+
+void shadeFragment(
+        int unifDim, const double unif[], int texNum, const texTexture *tex[],
+        int varyDim, const double vary[], double rgbd[4]) {
+	double sample[tex[0]->texelDim];
+	texSample(tex[0], vary[VARYS], vary[VARYT], sample);
+	sample[0] = sample[1] * 0.2 + 0.8;
+	sample[1] = sample[1] * 0.2 + 0.6;
+	sample[2] = 0.3;
+	double intensity = vary[VARYP] / vecLength(3, &vary[VARYN]);
+	vecScale(3, intensity, sample, rgbd);
+	rgbd[3] = vary[VARYZ];
+}
+
+/* Does the same as shadeFragment, for fragNum fragments at once, sampling the 
+texture for all of them with one texSampleN. Deferred shading uses it. */
+void shadeFragments(
+        int fragNum, int unifDim, const double unif[], int texNum, 
+        const texTexture *tex[], int varyDim, const double *varys[], 
+        double *rgbds[]) {
+	int texelDim = tex[0]->texelDim;
+	double samples[fragNum * texelDim];
+	texSampleN(tex[0], fragNum, varys[VARYS], varys[VARYT], samples);
+	const double *n = varys[VARYN], *o = varys[VARYO], *p = varys[VARYP];
+	for (int f = 0; f < fragNum; f += 1) {
+		double green = samples[f * texelDim + 1];
+		double intensity = p[f] / sqrt(n[f] * n[f] + o[f] * o[f] + p[f] * p[f]);
+		rgbds[0][f] = intensity * (green * 0.2 + 0.8);
+		rgbds[1][f] = intensity * (green * 0.2 + 0.6);
+		rgbds[2][f] = intensity * 0.3;
+		rgbds[3][f] = varys[VARYZ][f];
+	}
+}
+
+renRenderer ren;
+frameBuffer frame;
+depthBuffer buf;
+shaShading sha;
+texTexture texture;
+const texTexture *textures[1] = {&texture};
+const texTexture **tex = textures;
+double unif[16 + 16] = {
+	1.0, 0.0, 0.0, 0.0,
+	0.0, 1.0, 0.0, 0.0,
+	0.0, 0.0, 1.0, 0.0,
+	0.0, 0.0, 0.0, 1.0,
+	1.0, 0.0, 0.0, 0.0,
+	0.0, 1.0, 0.0, 0.0,
+	0.0, 0.0, 1.0, 0.0,
+	0.0, 0.0, 0.0, 1.0};
+double viewport[4][4];
+camCamera cam;
+
+/* Builds the landscape mesh of the given size, the same way every time: the
+faults, blurs, and bumps of 350mainClipping.c, from the fixed seed benchSEED.
+Returns 0 on success, non-zero on failure. */
+int buildLandscape(meshMesh *mesh, int size) {
+	double *landData = (double *)malloc((size_t)size * size * sizeof(double));
+	if (landData == NULL) {
+		fprintf(stderr, "error: buildLandscape: malloc failed\n");
+		return 1;
+	}
+	landFlat(size, landData, 0.0);
+	srand(benchSEED);
+	for (int i = 0; i < 12; i += 1)
+		landFaultRandomly(size, landData, 1.0 - i * 0.04);
+	for (int i = 0; i < 4; i += 1)
+		landBlur(size, landData);
+	for (int i = 0; i < 4; i += 1)
+		landBump(size, landData, landInt(0, size - 1), landInt(0, size - 1),
+			5.0, 1.0);
+	int error = mesh3DInitializeLandscape(mesh, size, 1.0, landData);
+	free(landData);
+	if (error != 0)
+		return 2;
+	for (int i = 0; i < mesh->vertNum; i += 1) {
+		double *attr = meshGetVertexPointer(mesh, i);
+		attr[ATTRS] = 0.0;
+		attr[ATTRT] = attr[ATTRZ];
+	}
+	meshUpdateBounds(mesh);
+	return 0;
+}
+
+/* Places the camera for frame number f of frameNum. It circles the middle of
+the landscape, 10 units up, looking a little down and partly inward, so that
+most frames see terrain all the way to the far plane. */
+void placeCamera(int size, int f, int frameNum) {
+	double t = 2.0 * M_PI * f / frameNum;
+	double radius = 0.3 * (size - 1), middle = 0.5 * (size - 1);
+	double position[3] = {
+		middle + radius * cos(t), middle + radius * sin(t), 10.0};
+	camLookFrom(&cam, position, M_PI * 0.6, t + 0.75 * M_PI);
+}
+
+/* Renders one frame, as 350mainClipping.c does, adding to the renderer's
+statistics. */
+void renderFrame(const meshMesh *mesh) {
+	double projInvIsom[4][4], planes[6][4];
+	frameClearRGB(&frame, 0.8, 0.8, 1.0);
+	depthClearDepths(&buf, 1000000000.0);
+	camGetProjectionInverseIsometry(&cam, projInvIsom);
+	vecCopy(16, (double *)projInvIsom, &unif[UNIFPROJINVISOM]);
+	camGetFrustumPlanes(&cam, planes);
+	if (!meshIsOutside(mesh, planes, 6))
+		meshRender(mesh, &ren, &frame, &buf, viewport, &sha, unif, tex);
+	framePresent(&frame);
+}
+
+int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* Returns the pth percentile of the num sorted values, by the nearest-rank
+method. */
+double getPercentile(int num, const double sorted[], double p) {
+	int rank = (int)ceil(p / 100.0 * num);
+	rank = (rank < 1 ? 1 : rank);
+	return sorted[rank - 1];
+}
+
+/* Benchmarks one landscape size, printing its JSON object. Returns 0 on
+success, non-zero on failure. */
+int benchmarkSize(int size, int frameNum) {
+	meshMesh mesh;
+	fprintf(stderr, "info: benchmarkSize: building landscape %d\n", size);
+	if (buildLandscape(&mesh, size) != 0) {
+		printf("{\"landSize\": %d, \"error\": \"could not build the landscape\"}",
+			size);
+		return 1;
+	}
+	double *times = (double *)malloc(frameNum * sizeof(double));
+	if (times == NULL) {
+		meshFinalize(&mesh);
+		printf("{\"landSize\": %d, \"error\": \"out of memory\"}", size);
+		return 2;
+	}
+	for (int f = 0; f < benchWARMUPS; f += 1) {
+		placeCamera(size, f, frameNum);
+		renderFrame(&mesh);
+	}
+	double total = 0.0;
+	renClearStatistics(&ren);
+	for (int f = 0; f < frameNum; f += 1) {
+		placeCamera(size, f, frameNum);
+		double start = renGetTime();
+		renderFrame(&mesh);
+		times[f] = renGetTime() - start;
+		total += times[f];
+	}
+	qsort(times, frameNum, sizeof(double), compareDoubles);
+	printf("{\"landSize\": %d, \"vertices\": %d, \"triangles\": %d, ", size,
+		mesh.vertNum, mesh.triNum);
+	printf("\"frameMs\": {\"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, "
+		"\"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f}, ", times[0] * 1000.0,
+		getPercentile(frameNum, times, 50.0) * 1000.0,
+		getPercentile(frameNum, times, 90.0) * 1000.0,
+		getPercentile(frameNum, times, 99.0) * 1000.0,
+		times[frameNum - 1] * 1000.0, total / frameNum * 1000.0);
+	renStatistics *stats = &ren.stats;
+	printf("\"stageMs\": {\"vertex\": %.4f, \"primitive\": %.4f, "
+		"\"raster\": %.4f}, ", stats->vertexTime / frameNum * 1000.0,
+		stats->primitiveTime / frameNum * 1000.0,
+		stats->rasterTime / frameNum * 1000.0);
+	printf("\"trianglesPerFrame\": {\"culled\": %.1f, \"rejected\": %.1f, "
+		"\"clippedOne\": %.1f, \"clippedTwo\": %.1f, \"rasterized\": %.1f}, ",
+		(double)stats->culledNum / frameNum, (double)stats->rejectedNum / frameNum,
+		(double)stats->clippedOneNum / frameNum,
+		(double)stats->clippedTwoNum / frameNum,
+		(double)stats->rasterizedNum / frameNum);
+	printf("\"overdraw\": %.4f, \"trianglesPerSecond\": %.1f, "
+		"\"pixelsPerSecond\": %.1f, \"pixelsPerFrame\": %.1f}",
+		renGetOverdraw(&ren, &buf) / frameNum,
+		(double)mesh.triNum * frameNum / total,
+		stats->counters.coveredNum / total,
+		(double)stats->counters.coveredNum / frameNum);
+	free(times);
+	meshFinalize(&mesh);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int threadNum = (argc > 1 ? atoi(argv[1]) : 1);
+	int frameNum = (argc > 2 ? atoi(argv[2]) : benchFRAMES);
+	frameNum = (frameNum < 1 ? 1 : frameNum);
+	/* Marshal resources. */
+	if (pixInitialize(benchWIDTH, benchHEIGHT, "Benchmark") != 0)
+		return 1;
+	if (renInitialize(&ren, threadNum) != 0) {
+		pixFinalize();
+		return 2;
+	}
+	/* Time the rasterizer even with one thread, so that stageMs splits the same 
+	way at every thread count. */
+	renSetTiming(&ren, 1);
+	renSetDeferred(&ren, benchDEFERRED);
+	if (frameInitialize(&frame, benchWIDTH, benchHEIGHT, frameRGBA8) != 0) {
+		renFinalize(&ren);
+		pixFinalize();
+		return 3;
+	}
+	if (depthInitialize(&buf, benchWIDTH, benchHEIGHT, depthDOUBLE) != 0) {
+		frameFinalize(&frame);
+		renFinalize(&ren);
+		pixFinalize();
+		return 4;
+	}
+	/* A checkerboard stands in for the demo's image, so that nothing has to be
+	loaded from a file. It is stored as texUNORM8, as an image file would be, and
+	tiled, as in the demo. */
+	double black[3] = {0.0, 0.0, 0.0}, white[3] = {1.0, 1.0, 1.0};
+	if (texInitializeSolid(&texture, 64, 64, 3, black) != 0) {
+		depthFinalize(&buf);
+		frameFinalize(&frame);
+		renFinalize(&ren);
+		pixFinalize();
+		return 5;
+	}
+	for (int i = 0; i < 64; i += 1)
+		for (int j = 0; j < 64; j += 1)
+			if ((i / 8 + j / 8) % 2 == 0)
+				texSetTexel(&texture, i, j, white);
+	if (texConvert(&texture, texUNORM8) != 0 ||
+			texSetLayout(&texture, texTILES) != 0) {
+		texFinalize(&texture);
+		depthFinalize(&buf);
+		frameFinalize(&frame);
+		renFinalize(&ren);
+		pixFinalize();
+		return 5;
+	}
+	texSetFiltering(&texture, benchFILTERING);
+	texSetLeftRight(&texture, texREPEAT);
+	texSetTopBottom(&texture, texREPEAT);
+	sha.unifDim = 16 + 16;
+	sha.attrDim = 3 + 2 + 3;
+	sha.varyDim = 4 + 2 + 3;
+	sha.shadeVertex = shadeVertex;
+	sha.shadeVertices = NULL;
+	sha.shadeFragment = shadeFragment;
+	sha.shadeFragments = shadeFragments;
+	sha.depthMode = shaEARLYDEPTH;
+	sha.cullMode = shaCULLBACK;
+	sha.texNum = 1;
+	sha.texCoordIndex = VARYS;
+	mat44Viewport(benchWIDTH, benchHEIGHT, viewport);
+	camSetProjectionType(&cam, camPERSPECTIVE);
+	camSetFrustum(&cam, M_PI / 6.0, 100.0, 10.0, benchWIDTH, benchHEIGHT);
+	/* Run the benchmark. */
+	int sizeNum = (argc > 3 ? argc - 3 : benchSIZENUM);
+	printf("{\"benchmark\": \"landscape\", \"threads\": %d, \"frames\": %d, "
+		"\"width\": %d, \"height\": %d, \"seed\": %d, \"results\": [\n",
+		ren.threadNum, frameNum, benchWIDTH, benchHEIGHT, benchSEED);
+	for (int k = 0; k < sizeNum; k += 1) {
+		int size = (argc > 3 ? atoi(argv[3 + k]) : benchSIZES[k]);
+		printf("  ");
+		if (size < 2)
+			printf("{\"landSize\": %d, \"error\": \"too small\"}", size);
+		else
+			benchmarkSize(size, frameNum);
+		printf("%s\n", (k + 1 < sizeNum ? "," : ""));
+		fflush(stdout);
+	}
+	printf("]}\n");
+	/* Clean up. */
+	texFinalize(&texture);
+	depthFinalize(&buf);
+	frameFinalize(&frame);
+	renFinalize(&ren);
+	pixFinalize();
+	return 0;
+}
@@ -0,0 +1,40 @@
+// Nathaniel Li
+
+/* A tool that cooks an image file into a cooked texture file, which
+texInitializeCooked maps into memory instead of decoding. The image is loaded
+with texInitializeFile, so it is stored as texUNORM8, and its mipmaps are built
+before it is written, so none of that work is left for load time. On Ubuntu,
+compile with...
+    cc -O2 380mainCook.c -lm
+and run with an image, the file to write, and optionally the word tiles, to
+store the texels in texTILES, as the landscape demo samples them. For example
+    ./a.out awesome.png awesome.tex tiles */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "150texture.c"
+
+int main(int argc, char *argv[]) {
+	texTexture texture;
+	if (argc < 3 || (argc > 3 && strcmp(argv[3], "tiles") != 0)) {
+		fprintf(stderr, "usage: %s image cooked [tiles]\n", argv[0]);
+		return 1;
+	}
+	if (texInitializeFile(&texture, argv[1]) != 0)
+		return 2;
+	if (argc > 3 && texSetLayout(&texture, texTILES) != 0) {
+		texFinalize(&texture);
+		return 3;
+	}
+	if (texWriteCooked(&texture, argv[2]) != 0) {
+		texFinalize(&texture);
+		return 4;
+	}
+	fprintf(stderr, "info: main: cooked %d x %d x %d texels, %d levels, into %s\n",
+		texture.width, texture.height, texture.texelDim, texture.levelNum,
+		argv[2]);
+	texFinalize(&texture);
+	return 0;
+}
@@ -0,0 +1,258 @@
+// Nathaniel Li
+
+
+/*** Creating and destroying (once per program) ***/
+
+/* A frame buffer holds the colors of the pixels of one frame, in memory that
+the renderer owns. Pixels are written with plain stores through frameSetRGB,
+and framePresent hands the whole frame to the pixel system at once, instead of
+calling pixSetRGB for every pixel. Coordinates are relative to the lower left
+corner, as in the pixel system. */
+
+/* The formats in which the buffer can store its colors. frameRGBA8 packs each
+pixel into four bytes, clamping each channel to [0, 1] and rounding it to 8
+bits, which is also what the display shows. frameFLOAT keeps four floats per
+pixel, for renderers that want to read back more precise colors. The fourth
+channel is padding, so that every pixel is one aligned load or store. */
+#define frameRGBA8 0
+#define frameFLOAT 1
+
+/* Clearing is lazy, as in the depth buffer, in frameTILESIZE x frameTILESIZE
+tiles of pixels. */
+#define frameTILESHIFT 3
+#define frameTILESIZE (1 << frameTILESHIFT)
+
+/* Feel free to read the struct's members, but don't write them, except through
+the accessors below such as frameSetRGB, etc. */
+typedef struct frameBuffer frameBuffer;
+struct frameBuffer {
+	int width, height, format;
+	void *colors;			/* width * height * 4 values, in the format's type */
+	double *present;		/* width * height * 3 doubles, for pixPasteRGB */
+	/* A tile whose generation is not the buffer's generation has not been
+	written since the last clear, so all of its pixels are clearRGB, whatever
+	its memory holds. Its pixels are only filled in when one of them is first
+	set. */
+	int tileCols, tileRows;
+	unsigned int generation;
+	unsigned int *generations;
+	double clearRGB[3];
+	double unorms[256];		/* the channel value of each 8-bit code */
+};
+
+/* Private. Returns the number of bytes used to store each pixel. */
+int frameGetSize(int format) {
+	if (format == frameFLOAT)
+		return 4 * sizeof(float);
+	else
+		return 4 * sizeof(unsigned char);
+}
+
+/* Initializes a frame buffer, storing its colors in the given format, such as
+frameRGBA8. To be presented, it must be the same size as the window. Returns 0
+on success, non-zero on failure. When you are finished with the buffer, you
+must call frameFinalize to deallocate its backing resources. */
+int frameInitialize(frameBuffer *buf, int width, int height, int format) {
+	int colorsSize, presentSize, tileNum, k;
+	if (format != frameRGBA8 && format != frameFLOAT) {
+		fprintf(stderr, "error: frameInitialize: unknown format %d\n", format);
+		return 2;
+	}
+	buf->tileCols = (width + frameTILESIZE - 1) >> frameTILESHIFT;
+	buf->tileRows = (height + frameTILESIZE - 1) >> frameTILESHIFT;
+	tileNum = buf->tileCols * buf->tileRows;
+	/* The doubles follow the colors, so round up to keep them aligned. */
+	colorsSize = width * height * frameGetSize(format);
+	colorsSize = (colorsSize + sizeof(double) - 1) / sizeof(double) *
+		sizeof(double);
+	presentSize = width * height * 3 * sizeof(double);
+	buf->colors = malloc(colorsSize + presentSize +
+		tileNum * sizeof(unsigned int));
+	if (buf->colors == NULL) {
+		fprintf(stderr, "error: frameInitialize: malloc failed\n");
+		return 1;
+	}
+	buf->width = width;
+	buf->height = height;
+	buf->format = format;
+	buf->present = (double *)((char *)buf->colors + colorsSize);
+	buf->generations = (unsigned int *)&buf->present[width * height * 3];
+	/* The buffer starts out cleared to black. */
+	for (k = 0; k < tileNum; k += 1)
+		buf->generations[k] = 0;
+	buf->generation = 1;
+	buf->clearRGB[0] = 0.0;
+	buf->clearRGB[1] = 0.0;
+	buf->clearRGB[2] = 0.0;
+	for (k = 0; k < 256; k += 1)
+		buf->unorms[k] = k / 255.0;
+	return 0;
+}
+
+/* Deallocates the resources backing the buffer. This function must be called
+when you are finished using a buffer. */
+void frameFinalize(frameBuffer *buf) {
+	free(buf->colors);
+}
+
+
+
+/*** Regular use (on each frame) ***/
+
+/* Private. Converts a channel to 8 bits, clamping it to [0, 1]. */
+unsigned char frameEncodeUnorm(double channel) {
+	/* Written without branches, so that it compiles to a min and a max. NaN
+	becomes 0. */
+	channel = (channel > 0.0 ? channel : 0.0);
+	channel = (channel < 1.0 ? channel : 1.0);
+	return (unsigned char)(channel * 255.0 + 0.5);
+}
+
+/* Private. Stores the color at index k of the colors, in the buffer's format. */
+void frameEncode(frameBuffer *buf, int k, double red, double green,
+		double blue) {
+	if (buf->format == frameRGBA8) {
+		unsigned char *rgba = &((unsigned char *)buf->colors)[4 * k];
+		rgba[0] = frameEncodeUnorm(red);
+		rgba[1] = frameEncodeUnorm(green);
+		rgba[2] = frameEncodeUnorm(blue);
+		rgba[3] = 255;
+	} else {
+		float *rgba = &((float *)buf->colors)[4 * k];
+		rgba[0] = red;
+		rgba[1] = green;
+		rgba[2] = blue;
+		rgba[3] = 1.0f;
+	}
+}
+
+/* Private. Loads the color at index k of the colors, as doubles. */
+void frameDecode(const frameBuffer *buf, int k, double rgb[3]) {
+	if (buf->format == frameRGBA8) {
+		const unsigned char *rgba = &((unsigned char *)buf->colors)[4 * k];
+		rgb[0] = buf->unorms[rgba[0]];
+		rgb[1] = buf->unorms[rgba[1]];
+		rgb[2] = buf->unorms[rgba[2]];
+	} else {
+		const float *rgba = &((float *)buf->colors)[4 * k];
+		rgb[0] = rgba[0];
+		rgb[1] = rgba[1];
+		rgb[2] = rgba[2];
+	}
+}
+
+/* Private. Fills the pixels of tile number tile with the clear color, which is
+why it has to be called before a pixel in a cleared tile is set. */
+void frameFillTile(frameBuffer *buf, int tile) {
+	int i, j;
+	int iMin = (tile % buf->tileCols) * frameTILESIZE;
+	int jMin = (tile / buf->tileCols) * frameTILESIZE;
+	int iMax = (iMin + frameTILESIZE < buf->width ? iMin + frameTILESIZE :
+		buf->width);
+	int jMax = (jMin + frameTILESIZE < buf->height ? jMin + frameTILESIZE :
+		buf->height);
+	/* Encode the clear color once, into the first pixel, and copy it. */
+	frameEncode(buf, iMin + buf->width * jMin, buf->clearRGB[0],
+		buf->clearRGB[1], buf->clearRGB[2]);
+	if (buf->format == frameRGBA8) {
+		unsigned int *rgbas = (unsigned int *)buf->colors;
+		unsigned int rgba = rgbas[iMin + buf->width * jMin];
+		for (j = jMin; j < jMax; j += 1)
+			for (i = iMin; i < iMax; i += 1)
+				rgbas[i + buf->width * j] = rgba;
+	} else {
+		float *rgbas = (float *)buf->colors;
+		const float *rgba = &rgbas[4 * (iMin + buf->width * jMin)];
+		float red = rgba[0], green = rgba[1], blue = rgba[2], alpha = rgba[3];
+		for (j = jMin; j < jMax; j += 1)
+			for (i = iMin; i < iMax; i += 1) {
+				rgbas[4 * (i + buf->width * j)] = red;
+				rgbas[4 * (i + buf->width * j) + 1] = green;
+				rgbas[4 * (i + buf->width * j) + 2] = blue;
+				rgbas[4 * (i + buf->width * j) + 3] = alpha;
+			}
+	}
+}
+
+/* Sets every pixel to the given color. Only a few numbers are written here.
+Each 8 x 8 tile of pixels is filled in when a pixel in it is first set, and
+tiles that nothing is drawn to are filled in only by framePresent. */
+void frameClearRGB(frameBuffer *buf, double red, double green, double blue) {
+	int k;
+	/* Store the color as the buffer's format would round it. */
+	double rgb[3] = {red, green, blue};
+	for (k = 0; k < 3; k += 1)
+		if (buf->format == frameRGBA8)
+			rgb[k] = frameEncodeUnorm(rgb[k]) / 255.0;
+		else
+			rgb[k] = (float)rgb[k];
+	buf->clearRGB[0] = rgb[0];
+	buf->clearRGB[1] = rgb[1];
+	buf->clearRGB[2] = rgb[2];
+	buf->generation += 1;
+	if (buf->generation == 0) {
+		/* After four billion clears, the old generations could come back. */
+		for (k = 0; k < buf->tileCols * buf->tileRows; k += 1)
+			buf->generations[k] = 0;
+		buf->generation = 1;
+	}
+}
+
+/* Sets the pixel at (x, y) to the given color, rounded to the buffer's format.
+Tiles never straddle a multiple of 8 pixels, so threads that each own their own
+tiles of the screen can call this safely on their own pixels. */
+void frameSetRGB(frameBuffer *buf, int x, int y, double red, double green,
+		double blue) {
+	if (0 <= x && x < buf->width && 0 <= y && y < buf->height) {
+		int tile = (x >> frameTILESHIFT) + buf->tileCols * (y >> frameTILESHIFT);
+		if (buf->generations[tile] != buf->generation) {
+			frameFillTile(buf, tile);
+			buf->generations[tile] = buf->generation;
+		}
+		frameEncode(buf, x + buf->width * y, red, green, blue);
+	}
+}
+
+/* Gets the color of the pixel at (x, y), as the buffer stores it. */
+void frameGetRGB(const frameBuffer *buf, int x, int y, double rgb[3]) {
+	if (0 <= x && x < buf->width && 0 <= y && y < buf->height) {
+		int tile = (x >> frameTILESHIFT) + buf->tileCols * (y >> frameTILESHIFT);
+		if (buf->generations[tile] != buf->generation) {
+			rgb[0] = buf->clearRGB[0];
+			rgb[1] = buf->clearRGB[1];
+			rgb[2] = buf->clearRGB[2];
+		} else
+			frameDecode(buf, x + buf->width * y, rgb);
+	} else {
+		/* There's no right answer, but we have to return something. */
+		rgb[0] = 0.0;
+		rgb[1] = 0.0;
+		rgb[2] = 0.0;
+	}
+}
+
+/* Copies the whole frame to the window, in one call to pixPasteRGB. The buffer
+must be the same size as the window. */
+void framePresent(frameBuffer *buf) {
+	int i, j, k, col, iMax;
+	const unsigned int *generations;
+	for (j = 0; j < buf->height; j += 1) {
+		generations = &buf->generations[buf->tileCols * (j >> frameTILESHIFT)];
+		/* Each row crosses the tiles one span of frameTILESIZE pixels at a time. */
+		for (col = 0; col < buf->tileCols; col += 1) {
+			i = col * frameTILESIZE;
+			iMax = (i + frameTILESIZE < buf->width ? i + frameTILESIZE :
+				buf->width);
+			if (generations[col] != buf->generation)
+				for (k = i + buf->width * j; i < iMax; i += 1, k += 1) {
+					buf->present[3 * k] = buf->clearRGB[0];
+					buf->present[3 * k + 1] = buf->clearRGB[1];
+					buf->present[3 * k + 2] = buf->clearRGB[2];
+				}
+			else
+				for (k = i + buf->width * j; i < iMax; i += 1, k += 1)
+					frameDecode(buf, k, &buf->present[3 * k]);
+		}
+	}
+	pixPasteRGB(buf->present);
+}
@@ -0,0 +1,223 @@
+// Nathaniel Li
+
+/* A headless implementation of the pixel system declared in 040pixel.h. It
+needs no display, no GPU, and no GLFW at all, neither the library nor the
+header: 040pixel.h defines the key constants when GLFW/glfw3.h is absent. The
+window is just memory. Compile it in place of 040pixel.o, for example
+    cc -I../Raytracer 350mainClipping.c ../Raytracer/040pixelHeadless.c -lm -lpthread
+from Rasterizer/.
+It is configured by environment variables:
+    PIX_FRAMES  the number of frames that pixRun runs before it returns, as if
+                the user had quit (default 1).
+    PIX_STEP    the seconds between frames on the clock passed to the time step
+                handler (default 1/60). The clock starts at 0 and is advanced
+                by exactly this much per frame, whatever the real time, so runs
+                are reproducible and go as fast as the CPU allows.
+    PIX_OUT     where to write frames, as binary PPM files. If it contains a
+                %, then it must be a single integer conversion %d, perhaps
+                with a zero flag and a width of up to two digits, such as
+                frame%04d.ppm. Then every frame is written, numbered from 0.
+                Any other % is an error, and nothing is run. Otherwise only
+                the last frame is written, to that path. If it is unset,
+                nothing is written. PPM is the only format: PNG would need an encoder,
+                and the tree has only the stb_image decoder, so convert the
+                frames with an outside tool if PNG is wanted.
+No user events ever happen, so the key and mouse handlers are never invoked. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "040pixel.h"
+
+#define pixDEFAULTSTEP (1.0 / 60.0)
+
+int pixWidth = 0, pixHeight = 0;
+double *pixColors = NULL;			/* pixWidth * pixHeight * 3 doubles */
+void (*pixTimeStepHandler)(double, double) = NULL;
+
+/* Private. Returns the channel as a byte, clamping it to [0, 1]. */
+unsigned char pixGetByte(double channel) {
+	if (!(channel > 0.0))
+		return 0;
+	else if (channel >= 1.0)
+		return 255;
+	else
+		return (unsigned char)(channel * 255.0 + 0.5);
+}
+
+/* Private. Writes the window to a binary PPM file, top row first. Returns 0 on
+success, non-zero on failure. */
+int pixWritePPM(const char *path) {
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "error: pixWritePPM: could not open %s\n", path);
+		return 1;
+	}
+	unsigned char *row = (unsigned char *)malloc(pixWidth * 3);
+	if (row == NULL) {
+		fprintf(stderr, "error: pixWritePPM: malloc failed\n");
+		fclose(file);
+		return 2;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", pixWidth, pixHeight);
+	for (int j = pixHeight - 1; j >= 0; j -= 1) {
+		for (int k = 0; k < pixWidth * 3; k += 1)
+			row[k] = pixGetByte(pixColors[pixWidth * 3 * j + k]);
+		fwrite(row, 1, pixWidth * 3, file);
+	}
+	free(row);
+	if (fclose(file) != 0) {
+		fprintf(stderr, "error: pixWritePPM: could not write %s\n", path);
+		return 3;
+	}
+	return 0;
+}
+
+
+/* Private. Returns 1 if path contains a single % and it begins an integer 
+conversion %d, possibly with a zero flag and a width of at most two digits, 
+such as %04d, and 0 otherwise. Only such a path is safe to use as the format 
+string of snprintf. */
+int pixIsNumbered(const char *path) {
+	const char *percent = strchr(path, '%'), *c;
+	if (percent == NULL || strchr(percent + 1, '%') != NULL)
+		return 0;
+	c = percent + 1;
+	if (*c == '0')
+		c += 1;
+	for (int k = 0; k < 2 && '0' <= *c && *c <= '9'; k += 1)
+		c += 1;
+	return (*c == 'd');
+}
+
+
+
+/*** Miscellaneous ***/
+
+int pixInitialize(int width, int height, const char *name) {
+	if (pixColors != NULL) {
+		fprintf(stderr, "error: pixInitialize: already initialized\n");
+		return 1;
+	}
+	if (width <= 0 || height <= 0) {
+		fprintf(stderr, "error: pixInitialize: bad size %d x %d\n", width,
+			height);
+		return 2;
+	}
+	pixColors = (double *)calloc((size_t)width * height * 3, sizeof(double));
+	if (pixColors == NULL) {
+		fprintf(stderr, "error: pixInitialize: calloc failed\n");
+		return 3;
+	}
+	pixWidth = width;
+	pixHeight = height;
+	pixTimeStepHandler = NULL;
+	return 0;
+}
+
+void pixRun(void) {
+	const char *frames = getenv("PIX_FRAMES"), *step = getenv("PIX_STEP");
+	const char *out = getenv("PIX_OUT");
+	int frameNum = (frames != NULL ? atoi(frames) : 1);
+	double dt = (step != NULL ? atof(step) : pixDEFAULTSTEP);
+	int numbered = (out != NULL && strchr(out, '%') != NULL);
+	char path[4096];
+	if (numbered && !pixIsNumbered(out)) {
+		fprintf(stderr, "error: pixRun: PIX_OUT %s must contain one %%d, such "
+			"as %%04d, and no other %%\n", out);
+		return;
+	}
+	for (int i = 0; i < frameNum; i += 1) {
+		if (pixTimeStepHandler != NULL)
+			pixTimeStepHandler(i * dt, (i + 1) * dt);
+		if (numbered) {
+			snprintf(path, sizeof(path), out, i);
+			if (pixWritePPM(path) != 0)
+				return;
+		}
+	}
+	if (out != NULL && !numbered)
+		pixWritePPM(out);
+}
+
+void pixFinalize(void) {
+	free(pixColors);
+	pixColors = NULL;
+	pixWidth = 0;
+	pixHeight = 0;
+}
+
+double pixGetR(int x, int y) {
+	if (0 <= x && x < pixWidth && 0 <= y && y < pixHeight)
+		return pixColors[(x + pixWidth * y) * 3];
+	return 0.0;
+}
+
+double pixGetG(int x, int y) {
+	if (0 <= x && x < pixWidth && 0 <= y && y < pixHeight)
+		return pixColors[(x + pixWidth * y) * 3 + 1];
+	return 0.0;
+}
+
+double pixGetB(int x, int y) {
+	if (0 <= x && x < pixWidth && 0 <= y && y < pixHeight)
+		return pixColors[(x + pixWidth * y) * 3 + 2];
+	return 0.0;
+}
+
+void pixSetRGB(int x, int y, double red, double green, double blue) {
+	if (0 <= x && x < pixWidth && 0 <= y && y < pixHeight) {
+		double *rgb = &pixColors[(x + pixWidth * y) * 3];
+		rgb[0] = red;
+		rgb[1] = green;
+		rgb[2] = blue;
+	}
+}
+
+void pixClearRGB(double red, double green, double blue) {
+	for (int k = 0; k < pixWidth * pixHeight; k += 1) {
+		pixColors[k * 3] = red;
+		pixColors[k * 3 + 1] = green;
+		pixColors[k * 3 + 2] = blue;
+	}
+}
+
+void pixCopyRGB(double *data) {
+	memcpy(data, pixColors, (size_t)pixWidth * pixHeight * 3 * sizeof(double));
+}
+
+void pixPasteRGB(double *data) {
+	memcpy(pixColors, data, (size_t)pixWidth * pixHeight * 3 * sizeof(double));
+}
+
+
+
+/*** Callbacks ***/
+
+/* No user events ever happen, so these handlers are accepted and ignored. */
+
+void pixSetKeyDownHandler(void (*handler)(int, int, int, int, int)) {
+}
+
+void pixSetKeyUpHandler(void (*handler)(int, int, int, int, int)) {
+}
+
+void pixSetKeyRepeatHandler(void (*handler)(int, int, int, int, int)) {
+}
+
+void pixSetMouseDownHandler(void (*handler)(double, double, int, int, int, int,
+		int)) {
+}
+
+void pixSetMouseUpHandler(void (*handler)(double, double, int, int, int, int,
+		int)) {
+}
+
+void pixSetMouseMoveHandler(void (*handler)(double, double)) {
+}
+
+void pixSetMouseScrollHandler(void (*handler)(double, double)) {
+}
+
+void pixSetTimeStepHandler(void (*handler)(double, double)) {
+	pixTimeStepHandler = handler;
+}
@@ -5,11 +5,22 @@
     clang 740mainMeshes.c 040pixel.o -lglfw -framework OpenGL -framework Cocoa -framework IOKit
 On Ubuntu, compile with...
     cc 640mainSpheres.c 040pixel.o -lglfw -lGL -lm -ldl
+Without a display, compile with 040pixelHeadless.c in place of 040pixel.o and 
+the graphics libraries, and see that file for how to run it...
+    cc -I../Rasterizer 740mainMeshes.c 040pixelHeadless.c -lm
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+#ifdef __has_include
+#if __has_include(<GLFW/glfw3.h>)
 #include <GLFW/glfw3.h>
+#endif
+#else
+#include <GLFW/glfw3.h>
+#endif
 #include "040pixel.h"
+#include "040frame.c"
 
 #include "650vector.c"
 #include "280matrix.c"
@@ -30,6 +41,7 @@ On Ubuntu, compile with...
 
 
 /*** ARTWORK ******************************************************************/
+frameBuffer frame;
 camCamera camera;
 double cameraTarget[3] = {0.0, 0.0, 0.0};
 double cameraRho = 10.0, cameraPhi = M_PI / 3.0, cameraTheta = M_PI / 3.0;
@@ -375,9 +387,10 @@ void render(void) {
             /* Set the pixel to the color of that ray. */
             double rgb[3];
             getSceneColor(3, bodyNum, bodies, cAmbient, lightNum, lights, p, d, rgb);
-            pixSetRGB(i, j, rgb[0], rgb[1], rgb[2]);
+            frameSetRGB(&frame, i, j, rgb[0], rgb[1], rgb[2]);
         }
     }
+    framePresent(&frame);
 }
 
 
@@ -425,7 +438,12 @@ void handleTimeStep(double oldTime, double newTime) {
 int main(void) {
     if (pixInitialize(SCREENWIDTH, SCREENHEIGHT, "640mainSpheres") != 0)
         return 1;
+    if (frameInitialize(&frame, SCREENWIDTH, SCREENHEIGHT, frameRGBA8) != 0) {
+        pixFinalize();
+        return 3;
+    }
     if (initializeArtwork() != 0) {
+        frameFinalize(&frame);
         pixFinalize();
         return 2;
     }
@@ -434,6 +452,7 @@ int main(void) {
     pixSetTimeStepHandler(handleTimeStep);
     pixRun();
     finalizeArtwork();
+    frameFinalize(&frame);
     pixFinalize();
     return 0;
 }